@@ -0,0 +1,590 @@
+/*
+*  bcache.c - Cache de setores compartilhada entre os sistemas de arquivos e
+*             os discos
+*
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "bcache.h"
+#include "util.h"
+
+//Tipo para representacao de uma entrada (setor) da cache
+typedef struct bcache_entry {
+	Disk *d;		//Disco do setor (NULL: entrada livre)
+	unsigned long addr;	//Endereco LBA do setor
+	int dirty;		//Setor modificado e ainda nao gravado em disco
+	int ref;		//Bit de referencia do algoritmo CLOCK
+	int pins;		//Fixacoes ativas (bcachePin)
+	int flushing;		//Gravacao em segundo plano em andamento
+	unsigned long dirtySince; //Instante em que o setor ficou sujo, em us
+	int hashNext;		//Proxima entrada do mesmo balde (-1: fim)
+	unsigned char *data;	//Conteudo do setor
+} BCacheEntry;
+
+BCacheEntry *bcacheEntries = NULL;	//Entradas da cache
+unsigned char *bcacheData = NULL;	//Area de dados de todas as entradas
+int *bcacheBuckets = NULL;		//Tabela hash (disco, setor) -> entrada
+unsigned int bcacheNumEntries = 0;	//Numero de entradas (e de baldes)
+unsigned int bcacheHand = 0;		//Ponteiro do CLOCK
+BCacheStats bcacheStats;		//Contadores da cache
+pthread_mutex_t bcacheLock = PTHREAD_MUTEX_INITIALIZER; //Protege a cache
+
+//Thread de gravacao em segundo plano (flusher)
+unsigned long bcacheDirtyAgeMs = BCACHE_DEFAULTDIRTYAGE; //Idade maxima
+unsigned int bcacheDirtyRatio = BCACHE_DEFAULTDIRTYRATIO; //Limite, em %
+int bcacheFlusherRunning = 0;		//Thread em execucao
+int bcacheFlusherStop = 0;		//Solicitacao de encerramento da thread
+pthread_t bcacheFlusherThread;		//Thread que grava os setores sujos
+pthread_cond_t bcacheFlusherWake = PTHREAD_COND_INITIALIZER; //Acorda a
+					//thread antes do proximo periodo
+unsigned int bcacheInFlight = 0;	//Setores em gravacao pela thread
+pthread_cond_t bcacheFlushDone = PTHREAD_COND_INITIALIZER; //Sinalizada a
+					//cada lote concluido pela thread
+int (*bcacheWritebackHook) (unsigned long, unsigned int) = NULL; //Gravacao
+					//da camada superior (bcacheSetWritebackHook)
+char bcacheOrphanTag;			//Endereco usado como disco das
+					//entradas orfas (BCACHE_ORPHAN)
+
+//Disco das entradas fixadas cujo disco foi invalidado (bcacheInvalidate).
+//Nao pertencem a tabela hash e sao liberadas na ultima bcacheUnpin
+#define BCACHE_ORPHAN ((Disk*) &bcacheOrphanTag)
+
+//Funcao interna que retorna o balde da tabela hash do setor addr de d
+unsigned int __bcacheHash(Disk *d, unsigned long addr) {
+	return hashKey (d, addr) % bcacheNumEntries;
+}
+
+//Funcao interna que retorna a entrada do setor addr de d ou -1 se o setor
+//nao estiver na cache
+int __bcacheLookup(Disk *d, unsigned long addr) {
+	int e = bcacheBuckets[__bcacheHash (d, addr)];
+	while (e >= 0 &&
+	       (bcacheEntries[e].d != d || bcacheEntries[e].addr != addr))
+		e = bcacheEntries[e].hashNext;
+	return e;
+}
+
+//Funcao interna que remove a entrada e de seu balde e a torna livre
+void __bcacheDrop(int e) {
+	int *link = &bcacheBuckets[__bcacheHash (bcacheEntries[e].d,
+	                                         bcacheEntries[e].addr)];
+	while (*link != e) link = &bcacheEntries[*link].hashNext;
+	*link = bcacheEntries[e].hashNext;
+	if (bcacheEntries[e].dirty) bcacheStats.dirtyEntries--;
+	bcacheEntries[e].d = NULL;
+	bcacheEntries[e].dirty = 0;
+	bcacheEntries[e].ref = 0;
+}
+
+//Funcao interna que grava em disco o setor sujo da entrada e. Retorna 0 ou
+//-1
+int __bcacheWriteBack(int e) {
+	if (diskWriteSector (bcacheEntries[e].d, bcacheEntries[e].addr,
+	                     bcacheEntries[e].data) < 0)
+		return -1;
+	bcacheEntries[e].dirty = 0;
+	bcacheStats.dirtyEntries--;
+	bcacheStats.writebacks++;
+	return 0;
+}
+
+//Funcao interna que decide, para clockSelect, se a entrada e pode ser
+//substituida. Entradas fixadas ou em gravacao sao sempre poupadas, e as
+//referenciadas, uma vez. Um setor sujo e' gravado antes; se a gravacao
+//falhar, a entrada e' poupada
+int __bcacheCanReplace(unsigned int e) {
+	if (!bcacheEntries[e].d) return 1;
+	if (bcacheEntries[e].pins || bcacheEntries[e].flushing) return 0;
+	if (bcacheEntries[e].ref) {
+		bcacheEntries[e].ref = 0;
+		return 0;
+	}
+	return (!bcacheEntries[e].dirty || __bcacheWriteBack (e) == 0);
+}
+
+//Funcao interna que obtem uma entrada para o setor addr de d, ausente da
+//cache, substituindo o setor escolhido pelo algoritmo CLOCK (clockSelect e
+//__bcacheCanReplace). Retorna a entrada, ja associada ao setor, ou -1 se
+//nenhuma entrada puder ser substituida
+int __bcacheAlloc(Disk *d, unsigned long addr) {
+	unsigned int h;
+	int e = clockSelect (&bcacheHand, bcacheNumEntries, __bcacheCanReplace);
+	if (e < 0) return -1;
+	if (bcacheEntries[e].d) {
+		__bcacheDrop (e);
+		bcacheStats.evictions++;
+	}
+	h = __bcacheHash (d, addr);
+	bcacheEntries[e].d = d;
+	bcacheEntries[e].addr = addr;
+	bcacheEntries[e].hashNext = bcacheBuckets[h];
+	bcacheBuckets[h] = e;
+	return e;
+}
+
+//Funcao interna que grava todos os setores sujos de d em um unico lote
+//ordenado por cilindro. Retorna 0 ou -1 se algum setor nao foi gravado
+int __bcacheFlushDisk(Disk *d) {
+	DiskRequest *reqs;
+	int *entries, ret = 0;
+	unsigned int n = 0;
+	for (unsigned int e = 0; e < bcacheNumEntries; e++)
+		if (bcacheEntries[e].d == d && bcacheEntries[e].dirty) n++;
+	if (!n) return 0;
+	reqs = malloc (n * sizeof (DiskRequest));
+	entries = malloc (n * sizeof (int));
+	if (!reqs || !entries) {
+		//Sem memoria para o lote: gravacao setor a setor
+		free (reqs);
+		free (entries);
+		for (unsigned int e = 0; e < bcacheNumEntries; e++)
+			if (bcacheEntries[e].d == d && bcacheEntries[e].dirty &&
+			    __bcacheWriteBack (e) < 0)
+				ret = -1;
+		return ret;
+	}
+	n = 0;
+	for (unsigned int e = 0; e < bcacheNumEntries; e++)
+		if (bcacheEntries[e].d == d && bcacheEntries[e].dirty) {
+			reqs[n].addr = bcacheEntries[e].addr;
+			reqs[n].data = bcacheEntries[e].data;
+			reqs[n].write = 1;
+			reqs[n].result = -1;
+			entries[n++] = e;
+		}
+	diskSubmitBatch (d, reqs, n);
+	for (unsigned int a = 0; a < n; a++)
+		if (reqs[a].result < 0) ret = -1;
+		else {
+			bcacheEntries[entries[a]].dirty = 0;
+			bcacheStats.dirtyEntries--;
+			bcacheStats.writebacks++;
+		}
+	free (reqs);
+	free (entries);
+	return ret;
+}
+
+//Funcao interna que aguarda a conclusao dos lotes em gravacao pela thread
+//de segundo plano, de modo que nenhuma gravacao antiga seja aplicada apos
+//outra mais recente. Deve ser chamada com bcacheLock adquirido
+void __bcacheWaitInFlight(void) {
+	while (bcacheInFlight > 0)
+		pthread_cond_wait (&bcacheFlushDone, &bcacheLock);
+}
+
+//Funcao interna que grava em segundo plano um lote de setores sujos: os do
+//disco do primeiro setor encontrado que esteja sujo ha mais de
+//bcacheDirtyAgeMs ou, se a proporcao de setores sujos exceder
+//bcacheDirtyRatio, todos os setores sujos desse disco. Os dados sao copiados
+//e gravados sem bcacheLock, em lote ordenado por cilindro; setores
+//modificados durante a gravacao permanecem sujos. Deve ser chamada com
+//bcacheLock adquirido. Retorna o numero de setores gravados, 0 se nao houver
+//o que gravar ou -1 em caso de erro
+int __bcacheFlushExpired(void) {
+	unsigned long limit = nowUs () - bcacheDirtyAgeMs * 1000;
+	int all = (bcacheStats.dirtyEntries * 100UL 
+	           >= (unsigned long) bcacheDirtyRatio * bcacheNumEntries);
+	DiskRequest *reqs;
+	unsigned char *buf;
+	int *entries, ret = 0;
+	unsigned int n = 0;
+	Disk *d = NULL;
+	for (unsigned int e = 0; e < bcacheNumEntries && !d; e++)
+		if (bcacheEntries[e].dirty && !bcacheEntries[e].flushing &&
+		    (all || bcacheEntries[e].dirtySince <= limit))
+			d = bcacheEntries[e].d;
+	if (!d) return 0;
+	for (unsigned int e = 0; e < bcacheNumEntries; e++)
+		if (bcacheEntries[e].d == d && bcacheEntries[e].dirty &&
+		    !bcacheEntries[e].flushing)
+			n++;
+	reqs = malloc (n * sizeof (DiskRequest));
+	entries = malloc (n * sizeof (int));
+	buf = malloc ((unsigned long) n * DISK_SECTORDATASIZE);
+	if (!reqs || !entries || !buf) {
+		free (reqs);
+		free (entries);
+		free (buf);
+		return -1;
+	}
+	n = 0;
+	for (unsigned int e = 0; e < bcacheNumEntries; e++) {
+		BCacheEntry *b = &bcacheEntries[e];
+		if (b->d != d || !b->dirty || b->flushing ||
+		    (!all && b->dirtySince > limit))
+			continue;
+		reqs[n].addr = b->addr;
+		reqs[n].data = &buf[n * DISK_SECTORDATASIZE];
+		reqs[n].write = 1;
+		reqs[n].result = -1;
+		memcpy (reqs[n].data, b->data, DISK_SECTORDATASIZE);
+		b->dirty = 0;
+		b->flushing = 1;
+		bcacheStats.dirtyEntries--;
+		entries[n++] = e;
+	}
+	bcacheInFlight += n;
+	pthread_mutex_unlock (&bcacheLock);
+	diskSubmitBatch (d, reqs, n);
+	pthread_mutex_lock (&bcacheLock);
+	for (unsigned int a = 0; a < n; a++) {
+		BCacheEntry *b = &bcacheEntries[entries[a]];
+		b->flushing = 0;
+		if (reqs[a].result == 0) bcacheStats.writebacks++;
+		else {
+			ret = -1;
+			if (!b->dirty) {
+				b->dirty = 1;
+				bcacheStats.dirtyEntries++;
+			}
+		}
+	}
+	bcacheStats.flushBatches++;
+	bcacheInFlight -= n;
+	pthread_cond_broadcast (&bcacheFlushDone);
+	free (reqs);
+	free (entries);
+	free (buf);
+	return (ret < 0 ? -1 : (int) n);
+}
+
+//Funcao interna executada pela thread de gravacao em segundo plano. A cada
+//metade de bcacheDirtyAgeMs, ou quando acordada por excesso de setores
+//sujos, executa a gravacao registrada em bcacheSetWritebackHook (sem
+//bcacheLock) e grava lotes ate que nao haja setores expirados
+void* __bcacheFlusher(void *arg) {
+	(void) arg;
+	pthread_mutex_lock (&bcacheLock);
+	while (!bcacheFlusherStop) {
+		unsigned long wake = nowUs () + bcacheDirtyAgeMs * 500 + 1000;
+		int (*hook) (unsigned long, unsigned int);
+		unsigned long dirtyAgeMs;
+		unsigned int dirtyRatio;
+		struct timespec ts;
+		ts.tv_sec = wake / 1000000;
+		ts.tv_nsec = wake % 1000000 * 1000L;
+		pthread_cond_timedwait (&bcacheFlusherWake, &bcacheLock, &ts);
+		hook = bcacheWritebackHook;
+		dirtyAgeMs = bcacheDirtyAgeMs;
+		dirtyRatio = bcacheDirtyRatio;
+		if (hook && !bcacheFlusherStop) {
+			pthread_mutex_unlock (&bcacheLock);
+			hook (dirtyAgeMs, dirtyRatio);
+			pthread_mutex_lock (&bcacheLock);
+		}
+		while (!bcacheFlusherStop && bcacheEntries &&
+		       __bcacheFlushExpired () > 0);
+	}
+	pthread_mutex_unlock (&bcacheLock);
+	return NULL;
+}
+
+//Funcao interna que grava os setores sujos de todos os discos. Retorna 0
+//ou -1
+int __bcacheFlushAll(void) {
+	int ret = 0;
+	for (unsigned int e = 0; e < bcacheNumEntries; e++)
+		if (bcacheEntries[e].dirty &&
+		    __bcacheFlushDisk (bcacheEntries[e].d) < 0)
+			ret = -1;
+	return ret;
+}
+
+//Funcao interna que (re)inicia a cache vazia com budgetBytes bytes de
+//dados, gravando antes os setores sujos. Retorna 0 ou -1
+int __bcacheSetup(unsigned long budgetBytes) {
+	unsigned int n = budgetBytes / DISK_SECTORDATASIZE;
+	//Setores fixados nao podem mudar de endereco
+	if (n < 1 || bcacheStats.pinnedEntries) return -1;
+	__bcacheWaitInFlight ();
+	if (__bcacheFlushAll () < 0) return -1;
+	free (bcacheEntries);
+	free (bcacheData);
+	free (bcacheBuckets);
+	bcacheEntries = calloc (n, sizeof (BCacheEntry));
+	bcacheData = malloc ((unsigned long) n * DISK_SECTORDATASIZE);
+	bcacheBuckets = malloc (n * sizeof (int));
+	bcacheNumEntries = n;
+	bcacheHand = 0;
+	if (!bcacheEntries || !bcacheData || !bcacheBuckets) {
+		free (bcacheEntries);
+		free (bcacheData);
+		free (bcacheBuckets);
+		bcacheEntries = NULL;
+		bcacheData = NULL;
+		bcacheBuckets = NULL;
+		bcacheNumEntries = 0;
+		return -1;
+	}
+	for (unsigned int e = 0; e < n; e++) {
+		bcacheEntries[e].data = &bcacheData[e * DISK_SECTORDATASIZE];
+		bcacheBuckets[e] = -1;
+	}
+	bcacheStats.numEntries = n;
+	bcacheStats.dirtyEntries = 0;
+	return 0;
+}
+
+//Funcao interna que inicia a cache com o orcamento padrao e a thread de
+//gravacao em segundo plano, se necessario. Retorna 0 ou -1
+int __bcacheEnsure(void) {
+	if (!bcacheFlusherRunning && bcacheDirtyAgeMs > 0) {
+		bcacheFlusherStop = 0;
+		if (pthread_create (&bcacheFlusherThread, NULL, __bcacheFlusher,
+		                    NULL) == 0)
+			bcacheFlusherRunning = 1;
+	}
+	if (bcacheEntries) return 0;
+	return __bcacheSetup (BCACHE_DEFAULTBUDGET);
+}
+
+//Funcao que define o orcamento de memoria da cache de setores, em bytes
+int bcacheSetBudget (unsigned long budgetBytes) {
+	int ret;
+	pthread_mutex_lock (&bcacheLock);
+	ret = __bcacheSetup (budgetBytes);
+	pthread_mutex_unlock (&bcacheLock);
+	return ret;
+}
+
+//Funcao que le count setores do disco d, a partir de addr, por meio da cache
+int bcacheReadSectors (Disk* d, unsigned long addr, unsigned long count,
+                       unsigned char* data) {
+	int ret = 0;
+	if (addr > diskGetNumSectors (d) || 
+	    count > diskGetNumSectors (d) - addr)
+		return -1;
+	pthread_mutex_lock (&bcacheLock);
+	if (__bcacheEnsure () < 0) ret = -1;
+	for (unsigned long b = 0, n; b < count && ret == 0; b += n) {
+		int e = __bcacheLookup (d, addr + b);
+		n = 1;
+		if (e >= 0) {
+			memcpy (&data[b*DISK_SECTORDATASIZE], bcacheEntries[e].data,
+			        DISK_SECTORDATASIZE);
+			bcacheEntries[e].ref = 1;
+			bcacheStats.hits++;
+			continue;
+		}
+		//Trecho de setores ausentes, lido do disco em uma so chamada
+		while (b + n < count && __bcacheLookup (d, addr + b + n) < 0)
+			n++;
+		ret = diskReadSectors (d, addr + b, n,
+		                       &data[b*DISK_SECTORDATASIZE]);
+		if (n > bcacheNumEntries / 4) {
+			bcacheStats.bypasses += n;
+			continue;
+		}
+		bcacheStats.misses += n;
+		for (unsigned long a = 0; a < n && ret == 0; a++) {
+			e = __bcacheAlloc (d, addr + b + a);
+			if (e < 0) break;
+			memcpy (bcacheEntries[e].data,
+			        &data[(b+a)*DISK_SECTORDATASIZE],
+			        DISK_SECTORDATASIZE);
+		}
+	}
+	pthread_mutex_unlock (&bcacheLock);
+	return ret;
+}
+
+//Funcao que escreve count setores no disco d, a partir de addr, por meio da
+//cache
+int bcacheWriteSectors (Disk* d, unsigned long addr, unsigned long count,
+                        unsigned char* data) {
+	int ret = 0;
+	if (addr > diskGetNumSectors (d) || 
+	    count > diskGetNumSectors (d) - addr)
+		return -1;
+	pthread_mutex_lock (&bcacheLock);
+	if (__bcacheEnsure () < 0) ret = -1;
+	else if (count > bcacheNumEntries / 4) {
+		//Transferencia longa: copias em cache ficam obsoletas e sao
+		//removidas, exceto as fixadas, atualizadas como setores limpos
+		__bcacheWaitInFlight ();
+		for (unsigned long b = 0; b < count; b++) {
+			int e = __bcacheLookup (d, addr + b);
+			if (e < 0) continue;
+			if (!bcacheEntries[e].pins) {
+				__bcacheDrop (e);
+				continue;
+			}
+			memcpy (bcacheEntries[e].data, &data[b*DISK_SECTORDATASIZE],
+			        DISK_SECTORDATASIZE);
+			if (bcacheEntries[e].dirty) {
+				bcacheEntries[e].dirty = 0;
+				bcacheStats.dirtyEntries--;
+			}
+		}
+		bcacheStats.bypasses += count;
+		ret = diskWriteSectors (d, addr, count, data);
+	}
+	else for (unsigned long b = 0; b < count && ret == 0; b++) {
+		unsigned char *sector = &data[b*DISK_SECTORDATASIZE];
+		int e = __bcacheLookup (d, addr + b);
+		if (e >= 0) bcacheStats.hits++;
+		else if ((e = __bcacheAlloc (d, addr + b)) < 0) {
+			ret = diskWriteSector (d, addr + b, sector);
+			continue;
+		}
+		memcpy (bcacheEntries[e].data, sector, DISK_SECTORDATASIZE);
+		if (!bcacheEntries[e].dirty) {
+			bcacheEntries[e].dirty = 1;
+			bcacheEntries[e].dirtySince = nowUs ();
+			bcacheStats.dirtyEntries++;
+		}
+		bcacheEntries[e].ref = 1;
+	}
+	//Excesso de setores sujos: a thread grava antes do proximo periodo
+	if (bcacheFlusherRunning && bcacheStats.dirtyEntries * 100UL >=
+	    (unsigned long) bcacheDirtyRatio * bcacheNumEntries)
+		pthread_cond_signal (&bcacheFlusherWake);
+	pthread_mutex_unlock (&bcacheLock);
+	return ret;
+}
+
+//Funcao que le um setor do disco d por meio da cache
+int bcacheReadSector (Disk* d, unsigned long addr, unsigned char* data) {
+	return bcacheReadSectors (d, addr, 1, data);
+}
+
+//Funcao que escreve um setor do disco d por meio da cache
+int bcacheWriteSector (Disk* d, unsigned long addr, unsigned char* data) {
+	return bcacheWriteSectors (d, addr, 1, data);
+}
+
+//Funcao que fixa na cache o setor addr do disco d e retorna um ponteiro
+//somente leitura para seus dados
+const unsigned char* bcachePin (Disk* d, unsigned long addr) {
+	const unsigned char *data = NULL;
+	int e = -1;
+	pthread_mutex_lock (&bcacheLock);
+	if (__bcacheEnsure () == 0) {
+		e = __bcacheLookup (d, addr);
+		if (e >= 0) bcacheStats.hits++;
+		else if ((e = __bcacheAlloc (d, addr)) >= 0) {
+			bcacheStats.misses++;
+			if (diskReadSector (d, addr, bcacheEntries[e].data) < 0) {
+				__bcacheDrop (e);
+				e = -1;
+			}
+		}
+	}
+	if (e >= 0) {
+		if (!bcacheEntries[e].pins++) bcacheStats.pinnedEntries++;
+		bcacheEntries[e].ref = 1;
+		data = bcacheEntries[e].data;
+	}
+	pthread_mutex_unlock (&bcacheLock);
+	return data;
+}
+
+//Funcao que desfaz uma fixacao do setor cujos dados contem o endereco ref
+int bcacheUnpin (const unsigned char* ref) {
+	int ret = -1;
+	pthread_mutex_lock (&bcacheLock);
+	if (bcacheData && ref >= bcacheData && 
+	    ref < bcacheData + (unsigned long) bcacheNumEntries 
+	                       * DISK_SECTORDATASIZE) {
+		int e = (ref - bcacheData) / DISK_SECTORDATASIZE;
+		if (bcacheEntries[e].pins > 0) {
+			if (!--bcacheEntries[e].pins) {
+				bcacheStats.pinnedEntries--;
+				if (bcacheEntries[e].d == BCACHE_ORPHAN) {
+					bcacheEntries[e].d = NULL;
+					bcacheEntries[e].ref = 0;
+				}
+			}
+			ret = 0;
+		}
+	}
+	pthread_mutex_unlock (&bcacheLock);
+	return ret;
+}
+
+//Funcao que grava no disco d todos os seus setores sujos presentes na cache
+int bcacheFlush (Disk* d) {
+	int ret = 0;
+	pthread_mutex_lock (&bcacheLock);
+	__bcacheWaitInFlight ();
+	if (bcacheEntries) ret = __bcacheFlushDisk (d);
+	pthread_mutex_unlock (&bcacheLock);
+	return ret;
+}
+
+//Funcao que grava em disco todos os setores sujos da cache, aguardando
+//tambem os lotes em gravacao pela thread de segundo plano
+int bcacheSync (void) {
+	int ret = 0;
+	pthread_mutex_lock (&bcacheLock);
+	__bcacheWaitInFlight ();
+	if (bcacheEntries) ret = __bcacheFlushAll ();
+	pthread_mutex_unlock (&bcacheLock);
+	return ret;
+}
+
+//Funcao que ajusta os limites da thread de gravacao em segundo plano
+int bcacheSetFlusher (unsigned long dirtyAgeMs, unsigned int dirtyRatio) {
+	int ret = 0;
+	if (dirtyRatio < 1 || dirtyRatio > 100) return -1;
+	pthread_mutex_lock (&bcacheLock);
+	bcacheDirtyAgeMs = dirtyAgeMs;
+	bcacheDirtyRatio = dirtyRatio;
+	if (bcacheFlusherRunning && dirtyAgeMs == 0) {
+		bcacheFlusherStop = 1;
+		pthread_cond_signal (&bcacheFlusherWake);
+		pthread_mutex_unlock (&bcacheLock);
+		pthread_join (bcacheFlusherThread, NULL);
+		pthread_mutex_lock (&bcacheLock);
+		bcacheFlusherRunning = 0;
+	}
+	else if (bcacheFlusherRunning)
+		pthread_cond_signal (&bcacheFlusherWake);
+	else if (dirtyAgeMs > 0 && __bcacheEnsure () < 0)
+		ret = -1;
+	pthread_mutex_unlock (&bcacheLock);
+	return ret;
+}
+
+//Funcao que registra a gravacao em segundo plano de uma camada superior
+void bcacheSetWritebackHook (int (*hook) (unsigned long dirtyAgeMs,
+                                          unsigned int dirtyRatio)) {
+	pthread_mutex_lock (&bcacheLock);
+	bcacheWritebackHook = hook;
+	pthread_mutex_unlock (&bcacheLock);
+}
+
+//Funcao que grava os setores sujos do disco d e remove da cache todos os
+//seus setores. Os fixados se tornam orfaos: deixam a tabela hash, mas seus
+//dados so sao liberados na ultima bcacheUnpin
+int bcacheInvalidate (Disk* d) {
+	int ret = 0;
+	pthread_mutex_lock (&bcacheLock);
+	__bcacheWaitInFlight ();
+	if (bcacheEntries) {
+		ret = __bcacheFlushDisk (d);
+		for (unsigned int e = 0; e < bcacheNumEntries; e++) {
+			int pins = bcacheEntries[e].pins;
+			if (bcacheEntries[e].d != d) continue;
+			__bcacheDrop (e);
+			if (pins) bcacheEntries[e].d = BCACHE_ORPHAN;
+		}
+	}
+	pthread_mutex_unlock (&bcacheLock);
+	return ret;
+}
+
+//Funcao que copia para *stats os contadores da cache de setores
+void bcacheGetStats (BCacheStats* stats) {
+	pthread_mutex_lock (&bcacheLock);
+	*stats = bcacheStats;
+	pthread_mutex_unlock (&bcacheLock);
+}
@@ -0,0 +1,125 @@
+/*
+*  bcache.h - Definicao da cache de setores entre os sistemas de arquivos e
+*             os discos
+*
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*/
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "disk.h"
+
+//Orcamento padrao de memoria da cache de setores, em bytes
+#define BCACHE_DEFAULTBUDGET (1024 * 1024)
+
+//Limites padrao da thread de gravacao em segundo plano (bcacheSetFlusher)
+#define BCACHE_DEFAULTDIRTYAGE 1000	//Idade maxima de um setor sujo, em ms
+#define BCACHE_DEFAULTDIRTYRATIO 20	//Percentual de setores sujos que
+					//antecipa a gravacao
+
+//Tipo de dados para a representacao dos contadores da cache de setores
+typedef struct bcache_stats {
+	unsigned long hits;		//Setores lidos ou escritos em memoria
+	unsigned long misses;		//Setores lidos do disco
+	unsigned long evictions;	//Setores substituidos (CLOCK)
+	unsigned long writebacks;	//Setores sujos gravados em disco
+	unsigned long bypasses;		//Setores de transferencias longas, que
+					//nao passam pela cache
+	unsigned int numEntries;	//Capacidade da cache, em setores
+	unsigned int dirtyEntries;	//Setores sujos presentes na cache
+	unsigned int pinnedEntries;	//Setores fixados (bcachePin)
+	unsigned long flushBatches;	//Lotes gravados em segundo plano
+} BCacheStats;
+
+//Funcao que define o orcamento de memoria da cache de setores, em bytes
+//(minimo de um setor). Os setores sujos sao gravados em seus discos e a
+//cache e' reiniciada vazia. Sem chamada previa, a cache usa
+//BCACHE_DEFAULTBUDGET. Retorna 0 se bem sucedida ou -1 caso contrario
+//(inclusive se houver setores fixados)
+int bcacheSetBudget (unsigned long budgetBytes);
+
+//Funcao que le count setores do disco d, a partir de addr, para data. Os
+//setores presentes na cache sao copiados da memoria e os ausentes sao lidos
+//do disco em trechos contiguos e mantidos na cache. Retorna 0 se a leitura
+//ocorreu sem erros ou -1 caso contrario
+int bcacheReadSectors (Disk* d, unsigned long addr, unsigned long count,
+                       unsigned char* data);
+
+//Funcao que escreve count setores de data no disco d, a partir de addr. Os
+//setores sao apenas marcados como sujos na cache e gravados no disco
+//posteriormente (write-back), pela thread de segundo plano, por substituicao
+//ou por bcacheFlush. Transferencias
+//maiores que um quarto da cache sao gravadas diretamente no disco. Retorna
+//0 se a escrita ocorreu sem erros ou -1 caso contrario
+int bcacheWriteSectors (Disk* d, unsigned long addr, unsigned long count,
+                        unsigned char* data);
+
+//Funcao que le um setor do disco d por meio da cache, como em
+//bcacheReadSectors
+int bcacheReadSector (Disk* d, unsigned long addr, unsigned char* data);
+
+//Funcao que escreve um setor do disco d por meio da cache, como em
+//bcacheWriteSectors
+int bcacheWriteSector (Disk* d, unsigned long addr, unsigned char* data);
+
+//Funcao que fixa na cache o setor addr do disco d, lendo-o do disco se
+//ausente, e retorna um ponteiro somente leitura para seus
+//DISK_SECTORDATASIZE bytes de dados. Um setor fixado nao e' substituido nem
+//removido da cache, e o ponteiro permanece valido ate a chamada
+//correspondente a bcacheUnpin; escritas posteriores no setor sao visiveis
+//por meio dele. Retorna NULL em caso de erro de leitura ou se nao houver
+//entrada que possa ser substituida
+const unsigned char* bcachePin (Disk* d, unsigned long addr);
+
+//Funcao que desfaz uma fixacao do setor cujos dados contem o endereco ref,
+//obtido a partir de bcachePin. Retorna 0 se bem sucedida ou -1 se ref nao
+//pertencer a um setor fixado
+int bcacheUnpin (const unsigned char* ref);
+
+//Funcao que grava no disco d todos os seus setores sujos presentes na
+//cache, em um unico lote ordenado por cilindro (diskSubmitBatch), apos
+//aguardar os lotes em gravacao pela thread de segundo plano. Retorna 0 se
+//bem sucedida ou -1 caso algum setor nao possa ser gravado
+int bcacheFlush (Disk* d);
+
+//Funcao que grava em disco todos os setores sujos da cache, de todos os
+//discos, e aguarda a conclusao dos lotes em gravacao pela thread de segundo
+//plano. Ao retornar, toda escrita anterior esta no disco. Retorna 0 se bem
+//sucedida ou -1 caso algum setor nao possa ser gravado
+int bcacheSync (void);
+
+//Funcao que ajusta a thread de gravacao em segundo plano, iniciada com a
+//cache. A thread grava em lotes ordenados por cilindro os setores sujos ha
+//mais de dirtyAgeMs milissegundos e, quando os setores sujos excedem
+//dirtyRatio por cento da cache, todos os setores sujos de um disco. As
+//escritas dos sistemas de arquivos se limitam a copias em memoria.
+//dirtyAgeMs igual a 0 encerra a thread (setores sujos sao gravados apenas
+//por substituicao ou bcacheFlush). Retorna 0 se bem sucedida ou -1 caso
+//dirtyRatio nao esteja entre 1 e 100 ou a thread nao possa ser criada
+int bcacheSetFlusher (unsigned long dirtyAgeMs, unsigned int dirtyRatio);
+
+//Funcao que registra hook como a gravacao em segundo plano de uma camada
+//acima da cache (como a cache de i-nodes). A cada periodo, a thread de
+//gravacao chama hook com os limites de bcacheSetFlusher, sem bloquear a
+//cache, antes de gravar os setores expirados; hook deve gravar seus dados
+//sujos ha mais de dirtyAgeMs ou, se excederem dirtyRatio por cento de sua
+//capacidade, todos eles. NULL remove o registro
+void bcacheSetWritebackHook (int (*hook) (unsigned long dirtyAgeMs,
+                                          unsigned int dirtyRatio));
+
+//Funcao que grava os setores sujos do disco d, como em bcacheFlush, e
+//remove da cache todos os seus setores. Deve ser chamada antes de
+//desconectar o disco. Setores fixados (bcachePin) deixam de pertencer a d,
+//mas seus dados permanecem validos ate a bcacheUnpin correspondente.
+//Retorna 0 se bem sucedida ou -1 caso algum setor nao possa ser gravado
+//(os setores sao removidos mesmo assim)
+int bcacheInvalidate (Disk* d);
+
+//Funcao que copia para *stats os contadores da cache de setores
+void bcacheGetStats (BCacheStats* stats);
+
+#endif
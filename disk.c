@@ -10,49 +10,954 @@
 *
 */
 
+#define _GNU_SOURCE	//O_DIRECT
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#if defined(__x86_64__)
+#   include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#   include <arm_acle.h>
+#endif
 #include "disk.h"
+#include "util.h"
 
 #define DISK_SEEKDELAY 10
+#define DISK_TRANSFERRATE 3938461	//Bytes/s: 130 us por setor de dados
+#define DISK_PROFILESUFFIX ".prof"	//Sufixo do arquivo de perfil do disco
+#define DISK_SCHEDDEADLINE 32	//Atendimentos maximos alem da posicao no lote
 
 #define DISK_SECTORSPERTRACK 64
+#define DISK_CREATETRACKS 32	//Trilhas gravadas por escrita na criacao
 #define DISK_SECTORDATAOFFSET 3
 #define DISK_SECTORTOTALSIZE (2*DISK_SECTORDATAOFFSET+DISK_SECTORDATASIZE)
 
 #define DISK_SECTORPREAMBLE " [["
-#define DISK_SECTORECC "]] "
+#define DISK_SECTORECC "]] "	//ECC de setores ainda sem CRC (imagens antigas)
+#define DISK_CRC32CPOLY 0x82F63B78	//Polinomio CRC32C (Castagnoli), refletido
+
+#define DISK_V2MAGIC "DSKIMGV2"	//Assinatura de imagens no formato v2
+#define DISK_V2MAGICSIZE 8
+#define DISK_V2HEADERSIZE 4096	//Cabecalho v2; os dados iniciam alinhados
+#define DISK_V2FLAGCRC 1	//Imagem v2 com tabela de CRC dos setores
+#define DISK_V2CRCSIZE 4	//Bytes por entrada da tabela de CRC
+#define DISK_CONVERTSECTORS 256	//Setores copiados por vez na conversao
+
+#define DISK_OVERLAYMAGIC "DSKOVLY1"	//Assinatura de arquivos de overlay
+#define DISK_OVERLAYHEADERSIZE 4096	//Cabecalho; o mapa de setores o segue
+
+#define DISK_DIRECTALIGN 4096	//Alinhamento exigido por O_DIRECT, em bytes
+#define DISK_DIRECTBUFSIZE 65536	//Tamanho de cada buffer alinhado do pool
+#define DISK_DIRECTPOOLSIZE 4	//Buffers alinhados por disco (O_DIRECT)
+
+#define DISK_TIERMAGIC "DSKTIER1"	//Assinatura de arquivos de camada rapida
+#define DISK_TIERHEADERSIZE 4096	//Cabecalho; os metadados o seguem
+#define DISK_TIERMETASIZE 16	//Bytes de metadados por posicao da camada
+#define DISK_TIERPROMOTE 2	//Acessos que promovem um setor lido
+#define DISK_TIERTRANSFERRATE 400000000	//Bytes/s da camada rapida
+
+//Tipo interno com o estado de uma posicao da camada rapida de um disco em
+//camadas
+typedef struct disk_tier_slot {
+	unsigned long addr;	//Setor do disco lento presente, mais 1 (0: livre)
+	long next;		//Proxima posicao na mesma lista do hash (ou -1)
+	unsigned char dirty;	//Dados ainda nao copiados para o disco lento
+	unsigned char ref;	//Bit de referencia do CLOCK
+} DiskTierSlot;
 
 //Estrutura para a representação de um disco fisico.
 //Seus membros etao protegidos, portanto use o tipo Disk e as funcoes externalizadas por disk.h.
 struct disk {
 	int id;				//Identificador do disco no sistema
-	FILE* fp;			//Arquivo que implementa o disco
+	int fd;				//Arquivo que implementa o disco
+	int backend;			//Backend de acesso, conforme DISK_BACKEND_*
+	unsigned char *map;		//Mapeamento do arquivo (DISK_BACKEND_MMAP)
+	unsigned long mapSize;		//Tamanho do mapeamento, em bytes
+	int directFd;			//Arquivo aberto com O_DIRECT (ou -1)
+	unsigned char *directPool[DISK_DIRECTPOOLSIZE]; //Buffers alinhados
+	unsigned int directFree;	//Mascara dos buffers livres no pool
+	pthread_mutex_t directLock;	//Protege o pool de buffers alinhados
+	pthread_cond_t directReleased;	//Sinalizada a cada buffer devolvido
+	int format;			//Formato da imagem, conforme DISK_FORMAT_*
+	unsigned long dataBase;		//Posicao do primeiro setor no arquivo
+	unsigned long sectorStride;	//Bytes ocupados por setor no arquivo
+	unsigned long sectorOffset;	//Deslocamento dos dados no setor
+	unsigned long crcBase;		//Posicao da tabela de CRC v2 (0: sem tabela)
+	int verify;			//Leituras conferem o CRC dos setores
 	unsigned long numCylinders;	//Numero de cilindros
 	unsigned long numSectors;	//Numero de setores
 	unsigned long size;		//Espaco util total para dados no disco
 	unsigned long currCylinder;	//Cilindro atual 
+	DiskProfile profile;		//Geometria e modelo de latencia
+	int virtualTime;		//Custos acumulados em vez de aguardados
+	unsigned long modeledUs;	//Tempo modelado de disco, em us
+	Disk **members;			//Membros de um disco em faixas (RAID-0)
+	unsigned int numMembers;	//Numero de membros (0: disco comum)
+	unsigned long stripeSectors;	//Setores por faixa em cada membro
+	Disk *base;			//Imagem base de um disco com overlay
+	char *basePath;			//Caminho da imagem base (reaberta para
+					//escrita em diskOverlayMerge)
+	unsigned char *ovlMap;		//Mapa de setores presentes no overlay
+	unsigned long ovlMapBase;	//Posicao do mapa no arquivo de overlay
+	unsigned char *trackBuf;	//Buffer de trilha da controladora (ou NULL)
+	unsigned long trackBufTrack;	//Trilha presente no buffer
+	int trackBufValid;		//Buffer contem uma trilha completa
+	unsigned char *trackBufBad;	//Setores da trilha cuja leitura falhou
+					//(1), relidos da midia a cada acesso
+	pthread_mutex_t trackLock;	//Protege o buffer de trilha
+	Disk *tierSlow;			//Disco lento de um disco em camadas
+	int tierPolicy;			//Politica de escrita (DISK_TIER_*)
+	DiskTierSlot *tierSlots;	//Posicoes da camada rapida
+	unsigned long tierNumSlots;	//Setores da camada rapida
+	unsigned long tierMetaBase;	//Posicao dos metadados no arquivo
+	long *tierBuckets;		//Hash de setores para posicoes (ou -1)
+	unsigned char *tierFreq;	//Contadores de acesso aos setores
+	unsigned long tierFreqSize;	//Entradas da tabela de contadores
+	unsigned long tierAccesses;	//Acessos desde o ultimo envelhecimento
+	unsigned long tierHand;		//Ponteiro do CLOCK
+	unsigned long tierWrites;	//Escritas atendidas desde a conexao
+	pthread_mutex_t tierLock;	//Protege contadores de acesso e bits de
+					//referencia sob ioLock compartilhado
+	pthread_mutex_t headLock;	//Protege cabecas, contadores e estatisticas
+	pthread_rwlock_t ioLock;	//Leituras em paralelo, escritas exclusivas
+	unsigned long schedFifoCyl;	//Cilindros que os lotes custariam em FIFO
+	unsigned long schedCyl;		//Cilindros efetivamente percorridos
+	DiskStats stats;		//Contadores de desempenho
+
+	//Filas de submissao e de conclusao de E/S assincrona
+	int aioRunning;			//Thread de E/S em execucao
+	int aioStop;			//Solicitacao de encerramento da thread
+	pthread_t aioThread;		//Thread que atende as submissoes
+	pthread_mutex_t aioLock;	//Protege as filas abaixo
+	pthread_cond_t aioSubmitted;	//Sinalizada a cada nova submissao
+	pthread_cond_t aioCompleted;	//Sinalizada a cada lote concluido
+	DiskRequest **aioSq;		//Requisicoes submetidas, nao atendidas
+	void **aioSqUserData;		//Dados do usuario das submissoes
+	unsigned int aioSqCount, aioSqCap;
+	DiskCompletion *aioCq;		//Conclusoes ainda nao coletadas
+	unsigned int aioCqCount, aioCqCap;
+	unsigned int aioInFlight;	//Requisicoes em atendimento pela thread
 };
 
+//Funcao interna, definida adiante, que encerra a thread de E/S assincrona
+void __diskAioShutdown(Disk *d);
+
+//Funcao interna, definida adiante, que transfere count setores contiguos
+int __diskTransferRun(Disk *d, unsigned long addr, unsigned long count,
+                      DiskIOVec *iov, unsigned int iovcnt, int write);
+
+//Funcao interna, definida adiante, que transfere setores de um disco em
+//camadas
+int __diskTierRun(Disk *d, DiskIOVec *iov, unsigned int iovcnt, int write);
+
+
+//Funcao interna que contabiliza uma chamada de leitura ou escrita de
+//numSectors setores, iniciada no instante startUs
+void __diskAccount(Disk *d, unsigned long numSectors, int write,
+                   unsigned long startUs) {
+	unsigned long latency = nowUs () - startUs;
+	pthread_mutex_lock (&d->headLock);
+	if (write) {
+		d->stats.writeCalls++;
+		d->stats.sectorsWritten += numSectors;
+		d->stats.bytesWritten += numSectors * DISK_SECTORDATASIZE;
+	}
+	else {
+		d->stats.readCalls++;
+		d->stats.sectorsRead += numSectors;
+		d->stats.bytesRead += numSectors * DISK_SECTORDATASIZE;
+	}
+	d->stats.totalLatencyUs += latency;
+	if (latency > d->stats.maxLatencyUs) d->stats.maxLatencyUs = latency;
+	//Discos em faixas tem a transferencia modelada em seus membros, e
+	//discos em camadas, em __diskTierRun
+	if (!d->numMembers && !d->tierSlow) 
+		d->modeledUs += numSectors * DISK_SECTORDATASIZE * 1000000UL
+		                / d->profile.transferRate;
+	pthread_mutex_unlock (&d->headLock);
+}
+
+//Funcao interna que aplica um atraso de us microssegundos do modelo do
+//disco: aguardado em tempo real ou apenas acumulado no relogio virtual.
+//Deve ser chamada com headLock adquirido
+void __diskDelay(Disk *d, unsigned long us) {
+	d->modeledUs += us;
+	if (!d->virtualTime && us > 0) {
+		struct timespec ts;
+		ts.tv_sec = us / 1000000;
+		ts.tv_nsec = us % 1000000 * 1000L;
+		nanosleep (&ts, NULL);
+	}
+}
+
+//Funcao interna que retorna a raiz quadrada inteira de n
+unsigned long __diskISqrt(unsigned long n) {
+	unsigned long r = 0, bit = 1UL << (sizeof (unsigned long) * 8 - 2);
+	while (bit > n) bit >>= 2;
+	while (bit) {
+		if (n >= r + bit) {
+			n -= r + bit;
+			r = (r >> 1) + bit;
+		}
+		else r >>= 1;
+		bit >>= 2;
+	}
+	return r;
+}
+
+//Funcao interna que retorna o custo, em us, de deslocar as cabecas por
+//cylOffset cilindros, segundo a curva de posicionamento do perfil: tempo de
+//acomodacao, fase de aceleracao (proporcional a raiz da distancia) e fase
+//de velocidade constante (proporcional a distancia). O deslocamento para um
+//cilindro vizinho pode ter custo proprio (troca de trilha)
+unsigned long __diskSeekCost(Disk *d, unsigned long cylOffset) {
+	DiskProfile *p = &d->profile;
+	if (cylOffset == 0) return 0;
+	if (cylOffset == 1 && p->trackSwitchUs) return p->trackSwitchUs;
+	return p->seekSettleUs + p->seekSqrtUs * __diskISqrt (cylOffset)
+	       + p->seekLinearUs * cylOffset;
+}
+
+//Funcao interna que desloca as cabecas ate o cilindro reqCyl
+//Insere o atraso do percurso, conforme o perfil do disco. Deve ser chamada
+//com headLock adquirido, pois ha um unico conjunto de cabecas
+void __diskMoveHead(Disk *d, unsigned long reqCyl) {
+	unsigned long cylOffset, cost;
+	cylOffset = (reqCyl < d->currCylinder 
+	             ? d->currCylinder - reqCyl
+	             : reqCyl - d->currCylinder);
+
+	cost = __diskSeekCost (d, cylOffset);
+	__diskDelay (d, cost);
+
+	if (cylOffset) {
+		d->stats.seeks++;
+		d->stats.cylindersTraversed += cylOffset;
+		d->stats.seekDelayUs += cost;
+	}
+	d->currCylinder = reqCyl;
+}
+
+//Funcao interna que aguarda a rotacao do prato ate que o setor addr passe
+//sob as cabecas. A posicao angular e' derivada do tempo modelado do disco.
+//Sem efeito se o perfil nao definir a velocidade de rotacao. Deve ser
+//chamada com headLock adquirido
+void __diskRotate(Disk *d, unsigned long addr) {
+	unsigned long spt = d->profile.sectorsPerTrack;
+	unsigned long revUs, under, target;
+	if (!d->profile.rpm) return;
+	revUs = 60000000UL / d->profile.rpm;
+	under = (d->modeledUs % revUs) * spt / revUs;
+	target = addr % spt;
+	__diskDelay (d, ((target + spt - under) % spt) * revUs / spt);
+}
 
 //Funcao interna, privada, para realizar o posicionamento
 //da cabeca sobre o setor desejado para leitura ou escrita
-//Insere um atraso a cada cilindro deslocado no percurso
-void __diskSeek(Disk *d, unsigned long addr) {
-	unsigned long reqCyl, cylOffset;
-	unsigned long sectorPos = addr * DISK_SECTORTOTALSIZE;
-	unsigned long dataPos = sectorPos + DISK_SECTORDATAOFFSET;
+//Insere o atraso de posicionamento e a latencia rotacional e leva as
+//cabecas ao cilindro do ultimo dos count setores da sequencia. O percurso
+//inteiro ocorre sob headLock: outra sequencia nao move as cabecas entre o
+//posicionamento e a travessia, embora as transferencias de dados no
+//arquivo possam ocorrer em paralelo
+void __diskSeek(Disk *d, unsigned long addr, unsigned long count) {
+	unsigned long reqCyl, lastCyl;
 
  	diskAddrToCylinder (d, addr, &reqCyl);
-	cylOffset = (reqCyl < d->currCylinder 
-                     ? d->currCylinder - reqCyl
-		     : reqCyl - d->currCylinder);
+	diskAddrToCylinder (d, addr + count - 1, &lastCyl);
+	pthread_mutex_lock (&d->headLock);
+	__diskMoveHead (d, reqCyl);
+	__diskRotate (d, addr);
+	__diskMoveHead (d, lastCyl);
+	pthread_mutex_unlock (&d->headLock);
+}
 
-	for (unsigned long i=1; i <= cylOffset; i++)
-		SLEEP (DISK_SEEKDELAY);
+//Funcao interna que retorna a posicao, no arquivo, dos dados do setor addr
+unsigned long __diskDataPos(Disk *d, unsigned long addr) {
+	return d->dataBase + addr * d->sectorStride + d->sectorOffset;
+}
 
-	fseek (d->fp, dataPos, 0);
-	d->currCylinder = reqCyl;
+//Funcao interna que traduz o endereco addr de um disco em faixas para o
+//membro que o contem, escrevendo em *memberAddr o endereco no membro
+Disk* __diskStripeMap(Disk *d, unsigned long addr, unsigned long *memberAddr) {
+	unsigned long stripe = addr / d->stripeSectors;
+	*memberAddr = (stripe / d->numMembers) * d->stripeSectors
+	              + addr % d->stripeSectors;
+	return d->members[stripe % d->numMembers];
+}
+
+//Funcao interna que transfere len bytes entre buf e a posicao pos do arquivo
+//fd, repetindo pread/pwrite ate concluir. Retorna 0 ou -1 em caso de erro
+int __diskPIO(int fd, unsigned long pos, unsigned char *buf,
+              unsigned long len, int write) {
+	while (len > 0) {
+		ssize_t n = write ? pwrite (fd, buf, len, pos)
+		                  : pread (fd, buf, len, pos);
+		if (n <= 0) return -1;
+		buf += n;
+		pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+//Funcao interna que retira um buffer alinhado do pool do disco, aguardando
+//a devolucao de um deles se todos estiverem em uso. Retorna seu indice
+int __diskDirectGet(Disk *d) {
+	int b;
+	pthread_mutex_lock (&d->directLock);
+	while (!d->directFree)
+		pthread_cond_wait (&d->directReleased, &d->directLock);
+	b = __builtin_ctz (d->directFree);
+	d->directFree &= ~(1U << b);
+	pthread_mutex_unlock (&d->directLock);
+	return b;
+}
+
+//Funcao interna que devolve ao pool o buffer alinhado de indice b
+void __diskDirectPut(Disk *d, int b) {
+	pthread_mutex_lock (&d->directLock);
+	d->directFree |= 1U << b;
+	pthread_cond_signal (&d->directReleased);
+	pthread_mutex_unlock (&d->directLock);
+}
+
+//Funcao interna que transfere len bytes na posicao pos por meio de O_DIRECT.
+//Cada trecho e' levado a blocos alinhados num buffer do pool; nas escritas,
+//apenas os blocos inicial e final parcialmente cobertos sao lidos antes
+//(leitura-modificacao-escrita). O final do arquivo, se nao alinhado, e'
+//acessado pelo descritor comum
+int __diskDirectIO(Disk *d, unsigned long pos, unsigned char *buf,
+                   unsigned long len, int write) {
+	int ret = 0, b = __diskDirectGet (d);
+	unsigned char *bounce = d->directPool[b];
+	while (len > 0 && ret == 0) {
+		unsigned long start = pos & ~(DISK_DIRECTALIGN - 1UL);
+		unsigned long skip = pos - start;
+		unsigned long n = DISK_DIRECTBUFSIZE - skip, span;
+		if (n > len) n = len;
+		span = (skip + n + DISK_DIRECTALIGN - 1) & ~(DISK_DIRECTALIGN - 1UL);
+		if (start + span > d->mapSize)
+			ret = __diskPIO (d->fd, pos, buf, n, write);
+		else if (write) {
+			unsigned long tail = span - DISK_DIRECTALIGN;
+			if (skip && __diskPIO (d->directFd, start, bounce, 
+			                       DISK_DIRECTALIGN, 0) < 0)
+				ret = -1;
+			else if ((skip + n) % DISK_DIRECTALIGN &&
+			         (tail || !skip) &&
+			         __diskPIO (d->directFd, start + tail, bounce + tail,
+			                    DISK_DIRECTALIGN, 0) < 0)
+				ret = -1;
+			else {
+				memcpy (bounce + skip, buf, n);
+				ret = __diskPIO (d->directFd, start, bounce, span, 1);
+			}
+		}
+		else {
+			ret = __diskPIO (d->directFd, start, bounce, span, 0);
+			if (ret == 0) memcpy (buf, bounce + skip, n);
+		}
+		buf += n;
+		pos += n;
+		len -= n;
+	}
+	__diskDirectPut (d, b);
+	return ret;
+}
+
+//Funcao interna que transfere len bytes entre buf e o arquivo do disco, a
+//partir da posicao pos, por meio do backend escolhido na conexao. Deve ser
+//chamada com ioLock adquirido. Retorna 0 ou -1
+int __diskRawIO(Disk *d, unsigned long pos, unsigned char *buf,
+                unsigned long len, int write) {
+	if (d->map) {
+		if (pos > d->mapSize || len > d->mapSize - pos) return -1;
+		if (write) memcpy (&d->map[pos], buf, len);
+		else memcpy (buf, &d->map[pos], len);
+		return 0;
+	}
+	if (d->directFd >= 0) return __diskDirectIO (d, pos, buf, len, write);
+	return __diskPIO (d->fd, pos, buf, len, write);
+}
+
+//Funcao interna que le len bytes do arquivo do disco, a partir da posicao
+//pos, por meio do backend escolhido na conexao. Leituras concorrentes sao
+//permitidas, pois o acesso e' posicional. Retorna 0 ou -1
+int __diskRawRead(Disk *d, unsigned long pos, unsigned char *buf,
+                  unsigned long len) {
+	int ret;
+	pthread_rwlock_rdlock (&d->ioLock);
+	ret = __diskRawIO (d, pos, buf, len, 0);
+	pthread_rwlock_unlock (&d->ioLock);
+	return ret;
+}
+
+//Funcao interna que escreve len bytes no arquivo do disco, a partir da
+//posicao pos, por meio do backend escolhido na conexao. Escritas sao
+//exclusivas, de modo que nenhuma leitura observa um setor parcialmente
+//escrito. Retorna 0 ou -1
+int __diskRawWrite(Disk *d, unsigned long pos, unsigned char *buf,
+                   unsigned long len) {
+	int ret;
+	pthread_rwlock_wrlock (&d->ioLock);
+	ret = __diskRawIO (d, pos, buf, len, 1);
+	pthread_rwlock_unlock (&d->ioLock);
+	return ret;
+}
+
+//Funcao interna que inicializa o estado comum a todo disco conectado:
+//cabecas, travas, contadores e filas de E/S assincrona
+void __diskInit(Disk *d, int id) {
+	d->id = id;
+	d->currCylinder = 0;
+	diskDefaultProfile (&d->profile);
+	d->virtualTime = 0;
+	d->modeledUs = 0;
+	d->members = NULL;
+	d->numMembers = 0;
+	d->stripeSectors = 0;
+	d->base = NULL;
+	d->basePath = NULL;
+	d->ovlMap = NULL;
+	d->ovlMapBase = 0;
+	d->trackBuf = NULL;
+	d->trackBufTrack = 0;
+	d->trackBufValid = 0;
+	d->trackBufBad = NULL;
+	pthread_mutex_init (&d->trackLock, NULL);
+	d->tierSlow = NULL;
+	d->tierPolicy = DISK_TIER_WRITEBACK;
+	d->tierSlots = NULL;
+	d->tierNumSlots = 0;
+	d->tierMetaBase = 0;
+	d->tierBuckets = NULL;
+	d->tierFreq = NULL;
+	d->tierFreqSize = 0;
+	d->tierAccesses = 0;
+	d->tierHand = 0;
+	d->tierWrites = 0;
+	pthread_mutex_init (&d->tierLock, NULL);
+	d->crcBase = 0;
+	d->verify = 1;
+	d->directFd = -1;
+	memset (d->directPool, 0, sizeof (d->directPool));
+	d->directFree = 0;
+	pthread_mutex_init (&d->directLock, NULL);
+	pthread_cond_init (&d->directReleased, NULL);
+	pthread_mutex_init (&d->headLock, NULL);
+	pthread_rwlock_init (&d->ioLock, NULL);
+	d->schedFifoCyl = 0;
+	d->schedCyl = 0;
+	memset (&d->stats, 0, sizeof (DiskStats));
+	d->aioRunning = 0;
+	d->aioStop = 0;
+	pthread_mutex_init (&d->aioLock, NULL);
+	pthread_cond_init (&d->aioSubmitted, NULL);
+	pthread_cond_init (&d->aioCompleted, NULL);
+	d->aioSq = NULL;
+	d->aioSqUserData = NULL;
+	d->aioSqCount = d->aioSqCap = 0;
+	d->aioCq = NULL;
+	d->aioCqCount = d->aioCqCap = 0;
+	d->aioInFlight = 0;
+}
+
+//Funcao que preenche *p com o perfil padrao de um disco: 64 setores por
+//trilha, 10 ms por cilindro percorrido, sem latencia rotacional
+void diskDefaultProfile (DiskProfile* p) {
+	p->sectorsPerTrack = DISK_SECTORSPERTRACK;
+	p->seekSettleUs = 0;
+	p->seekSqrtUs = 0;
+	p->seekLinearUs = DISK_SEEKDELAY * 1000UL;
+	p->trackSwitchUs = 0;
+	p->rpm = 0;
+	p->transferRate = DISK_TRANSFERRATE;
+}
+
+//Funcao interna que converte em *value o numero decimal sem sinal em c,
+//seguido apenas de espacos e do fim da linha. Retorna 0 ou -1 se c nao for
+//um numero valido (inclusive negativo) ou exceder unsigned long
+int __diskParseValue(char *c, unsigned long *value) {
+	char *end;
+	if (*c < '0' || *c > '9') return -1;
+	errno = 0;
+	*value = strtoul (c, &end, 10);
+	if (errno == ERANGE) return -1;
+	while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+		end++;
+	return (*end == '\0' ? 0 : -1);
+}
+
+//Funcao que carrega em *p o perfil de desempenho descrito no arquivo texto
+//profilePath, com uma linha chave=valor por parametro (mesmos nomes dos
+//campos de DiskProfile, com valores decimais sem sinal) e comentarios
+//iniciados por '#'. Parametros ausentes mantem os valores padrao. Retorna 0
+//se bem sucedida ou -1 caso o arquivo nao exista ou seja invalido
+int diskLoadProfile (char* profilePath, DiskProfile* p) {
+	char line[128], key[64];
+	unsigned long value;
+	int ret = 0, n;
+	FILE *fp = fopen (profilePath, "r");
+	if (!fp) return -1;
+	diskDefaultProfile (p);
+	while (ret == 0 && fgets (line, sizeof (line), fp)) {
+		char *c = line;
+		while (*c == ' ' || *c == '\t') c++;
+		if (*c == '#' || *c == '\n' || *c == '\r' || *c == '\0')
+			continue;
+		n = -1;
+		if (sscanf (c, " %63[^= \t] = %n", key, &n) != 1 || n < 0 ||
+		    __diskParseValue (&c[n], &value) < 0)
+			ret = -1;
+		else if (!strcmp (key, "sectorsPerTrack")) 
+			p->sectorsPerTrack = value;
+		else if (!strcmp (key, "seekSettleUs")) p->seekSettleUs = value;
+		else if (!strcmp (key, "seekSqrtUs")) p->seekSqrtUs = value;
+		else if (!strcmp (key, "seekLinearUs")) p->seekLinearUs = value;
+		else if (!strcmp (key, "trackSwitchUs")) 
+			p->trackSwitchUs = value;
+		else if (!strcmp (key, "rpm")) p->rpm = value;
+		else if (!strcmp (key, "transferRate")) p->transferRate = value;
+		else ret = -1;
+	}
+	fclose (fp);
+	//Uma volta do prato deve durar ao menos 1 us (__diskRotate)
+	if (p->sectorsPerTrack == 0 || p->transferRate == 0 || 
+	    p->rpm > 60000000UL)
+		ret = -1;
+	return ret;
+}
+
+//Funcao interna que carrega o perfil do disco a partir do arquivo de perfil
+//que acompanha a imagem (rawDiskPath seguido de DISK_PROFILESUFFIX), se
+//existir. Retorna 0 se nao houver perfil ou se ele for valido, e -1 caso
+//contrario
+int __diskLoadSidecarProfile(Disk *d, char *rawDiskPath) {
+	size_t len = strlen (rawDiskPath);
+	char *profilePath = malloc (len + sizeof (DISK_PROFILESUFFIX));
+	FILE *fp;
+	int ret = 0;
+	if (!profilePath) return -1;
+	memcpy (profilePath, rawDiskPath, len);
+	memcpy (&profilePath[len], DISK_PROFILESUFFIX, 
+	        sizeof (DISK_PROFILESUFFIX));
+	fp = fopen (profilePath, "r");
+	if (fp) {
+		unsigned long sectorsPerTrack = d->profile.sectorsPerTrack;
+		fclose (fp);
+		ret = diskLoadProfile (profilePath, &d->profile);
+		//A geometria registrada em imagens v2 prevalece sobre o perfil
+		if (d->format == DISK_FORMAT_V2)
+			d->profile.sectorsPerTrack = sectorsPerTrack;
+	}
+	free (profilePath);
+	return ret;
+}
+
+//Funcao interna que grava em buf o valor v, em little-endian, com n bytes
+void __diskPutLE(unsigned char *buf, unsigned long v, int n) {
+	for (int i = 0; i < n; i++) buf[i] = (v >> (i*8)) & 0xFF;
+}
+
+//Funcao interna que le de buf um valor little-endian de n bytes
+unsigned long __diskGetLE(unsigned char *buf, int n) {
+	unsigned long v = 0;
+	for (int i = 0; i < n; i++) v |= (unsigned long) buf[i] << (i*8);
+	return v;
+}
+
+//Tabelas do CRC32C por software, processando 8 bytes por passo
+unsigned int __diskCrcTable[8][256];
+//Implementacao do CRC32C escolhida conforme o processador hospedeiro
+unsigned int (*__diskCrcUpdate)(unsigned int, unsigned char*, unsigned long);
+pthread_once_t __diskCrcOnce = PTHREAD_ONCE_INIT;
+
+//Funcao interna que atualiza crc com len bytes de buf usando as tabelas
+unsigned int __diskCrcUpdateTable(unsigned int crc, unsigned char *buf,
+                                  unsigned long len) {
+	while (len >= 8) {
+		unsigned int lo = crc ^ (buf[0] | buf[1] << 8 | buf[2] << 16 |
+		                         (unsigned int) buf[3] << 24);
+		crc = __diskCrcTable[7][lo & 0xFF] ^
+		      __diskCrcTable[6][(lo >> 8) & 0xFF] ^
+		      __diskCrcTable[5][(lo >> 16) & 0xFF] ^
+		      __diskCrcTable[4][lo >> 24] ^
+		      __diskCrcTable[3][buf[4]] ^ __diskCrcTable[2][buf[5]] ^
+		      __diskCrcTable[1][buf[6]] ^ __diskCrcTable[0][buf[7]];
+		buf += 8;
+		len -= 8;
+	}
+	while (len-- > 0)
+		crc = __diskCrcTable[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+//Funcao interna que atualiza crc com len bytes de buf usando a instrucao
+//crc32 do SSE4.2
+__attribute__((target("sse4.2")))
+unsigned int __diskCrcUpdateHw(unsigned int crc, unsigned char *buf,
+                               unsigned long len) {
+	unsigned long long c = crc;
+	while (len >= 8) {
+		unsigned long long v;
+		memcpy (&v, buf, 8);
+		c = _mm_crc32_u64 (c, v);
+		buf += 8;
+		len -= 8;
+	}
+	crc = c;
+	while (len-- > 0) crc = _mm_crc32_u8 (crc, *buf++);
+	return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+//Funcao interna que atualiza crc com len bytes de buf usando as instrucoes
+//crc32c do ARMv8
+unsigned int __diskCrcUpdateHw(unsigned int crc, unsigned char *buf,
+                               unsigned long len) {
+	while (len >= 8) {
+		unsigned long long v;
+		memcpy (&v, buf, 8);
+		crc = __crc32cd (crc, v);
+		buf += 8;
+		len -= 8;
+	}
+	while (len-- > 0) crc = __crc32cb (crc, *buf++);
+	return crc;
+}
+#endif
+
+//Funcao interna que monta as tabelas e escolhe a implementacao do CRC32C
+void __diskCrcInit(void) {
+	for (unsigned int i = 0; i < 256; i++) {
+		unsigned int c = i;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? (c >> 1) ^ DISK_CRC32CPOLY : c >> 1;
+		__diskCrcTable[0][i] = c;
+	}
+	for (unsigned int i = 0; i < 256; i++)
+		for (int k = 1; k < 8; k++)
+			__diskCrcTable[k][i] = (__diskCrcTable[k-1][i] >> 8) ^
+				__diskCrcTable[0][__diskCrcTable[k-1][i] & 0xFF];
+	__diskCrcUpdate = __diskCrcUpdateTable;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports ("sse4.2"))
+		__diskCrcUpdate = __diskCrcUpdateHw;
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	__diskCrcUpdate = __diskCrcUpdateHw;
+#endif
+}
+
+//Funcao interna que retorna o CRC32C dos dados de um setor
+unsigned int __diskSectorCrc(unsigned char *data) {
+	pthread_once (&__diskCrcOnce, __diskCrcInit);
+	return ~__diskCrcUpdate (~0U, data, DISK_SECTORDATASIZE);
+}
+
+//Funcao interna que grava no ECC v1 de um setor (trailer) os 24 bits
+//inferiores do CRC32C de seus dados
+void __diskPutTrailer(unsigned char *trailer, unsigned char *data) {
+	__diskPutLE (trailer, __diskSectorCrc (data), DISK_SECTORDATAOFFSET);
+}
+
+//Funcao interna que confere os dados de um setor v1 contra seu ECC. Setores
+//com o ECC constante DISK_SECTORECC nao possuem CRC e sao aceitos.
+//Retorna 0 ou -1 se o setor estiver corrompido
+int __diskCheckTrailer(unsigned char *trailer, unsigned char *data) {
+	if (memcmp (trailer, DISK_SECTORECC, DISK_SECTORDATAOFFSET) == 0)
+		return 0;
+	if (__diskGetLE (trailer, DISK_SECTORDATAOFFSET) !=
+	    (__diskSectorCrc (data) & 0xFFFFFF))
+		return -1;
+	return 0;
+}
+
+//Funcao interna que grava (write diferente de 0) ou confere as entradas da
+//tabela de CRC v2 dos count setores a partir de addr, cujos dados estao em
+//data. Entradas nulas nao possuem CRC. Setores corrompidos sao somados a
+//*bad e o menor endereco entre eles e' mantido em *firstBad. Deve ser
+//chamada com ioLock adquirido. Retorna 0 ou -1 em caso de erro de E/S
+int __diskV2Checksums(Disk *d, unsigned long addr, unsigned long count,
+                      unsigned char *data, int write, unsigned long *bad,
+                      unsigned long *firstBad) {
+	unsigned char sums[DISK_CONVERTSECTORS * DISK_V2CRCSIZE];
+	while (count > 0) {
+		unsigned long n = count < DISK_CONVERTSECTORS ? 
+		                  count : DISK_CONVERTSECTORS;
+		unsigned long pos = d->crcBase + addr * DISK_V2CRCSIZE;
+		if (!write && __diskRawIO (d, pos, sums, n * DISK_V2CRCSIZE, 0) < 0)
+			return -1;
+		for (unsigned long i = 0; i < n; i++) {
+			unsigned char *sum = &sums[i * DISK_V2CRCSIZE];
+			unsigned int crc = __diskSectorCrc (
+				&data[i * DISK_SECTORDATASIZE]);
+			if (write) __diskPutLE (sum, crc, DISK_V2CRCSIZE);
+			else if (__diskGetLE (sum, DISK_V2CRCSIZE) != 0 &&
+			         __diskGetLE (sum, DISK_V2CRCSIZE) != crc) {
+				if (*bad == 0 || addr + i < *firstBad)
+					*firstBad = addr + i;
+				(*bad)++;
+			}
+		}
+		if (write && __diskRawIO (d, pos, sums, n * DISK_V2CRCSIZE, 1) < 0)
+			return -1;
+		addr += n;
+		data += n * DISK_SECTORDATASIZE;
+		count -= n;
+	}
+	return 0;
+}
+
+//Funcao interna que identifica o formato da imagem conectada e preenche o
+//leiaute dos setores no arquivo. Imagens v2 iniciam com DISK_V2MAGIC,
+//seguida de versao (4 bytes), setores por trilha (4 bytes), numero de
+//setores (8 bytes), posicao dos dados (8 bytes), opcoes (4 bytes,
+//DISK_V2FLAG*) e posicao da tabela de CRC (8 bytes), em little-endian.
+//Demais imagens sao v1. Retorna 0 se bem sucedida ou -1 caso o cabecalho
+//v2 seja invalido
+int __diskDetectFormat(Disk *d) {
+	unsigned char header[DISK_V2MAGICSIZE + 36];
+	d->format = DISK_FORMAT_V1;
+	d->dataBase = 0;
+	d->sectorStride = DISK_SECTORTOTALSIZE;
+	d->sectorOffset = DISK_SECTORDATAOFFSET;
+	d->numSectors = d->mapSize / DISK_SECTORTOTALSIZE;
+	if (pread (d->fd, header, sizeof (header), 0) != sizeof (header) ||
+	    memcmp (header, DISK_V2MAGIC, DISK_V2MAGICSIZE) != 0)
+		return 0;
+	d->format = DISK_FORMAT_V2;
+	d->sectorStride = DISK_SECTORDATASIZE;
+	d->sectorOffset = 0;
+	d->profile.sectorsPerTrack = __diskGetLE (&header[12], 4);
+	d->numSectors = __diskGetLE (&header[16], 8);
+	d->dataBase = __diskGetLE (&header[24], 8);
+	if (__diskGetLE (&header[32], 4) & DISK_V2FLAGCRC)
+		d->crcBase = __diskGetLE (&header[36], 8);
+	if (__diskGetLE (&header[8], 4) != DISK_FORMAT_V2 ||
+	    d->profile.sectorsPerTrack == 0 ||
+	    d->dataBase < sizeof (header) ||
+	    d->dataBase > d->mapSize ||
+	    d->numSectors > (d->mapSize - d->dataBase) / DISK_SECTORDATASIZE)
+		return -1;
+	if (d->crcBase && (d->crcBase < sizeof (header) ||
+	                   d->crcBase > d->dataBase ||
+	                   d->numSectors > (d->dataBase - d->crcBase) 
+	                                   / DISK_V2CRCSIZE))
+		return -1;
+	return 0;
+}
+
+//Funcao interna que cria uma imagem v2 vazia em rawDiskPath, com
+//numSectors setores e sectorsPerTrack setores por trilha. Os setores sao
+//preenchidos com espacos, como na formatacao de baixo nivel v1, e a tabela
+//de CRC segue o cabecalho. Retorna 0 se bem sucedida ou -1 caso contrario
+int __diskCreateV2(char *rawDiskPath, unsigned long numSectors,
+                   unsigned long sectorsPerTrack) {
+	unsigned char header[DISK_V2HEADERSIZE];
+	unsigned char *sectors;
+	unsigned long chunk = DISK_CONVERTSECTORS;
+	unsigned long tableSize = (numSectors * DISK_V2CRCSIZE + 
+	                           DISK_V2HEADERSIZE - 1) 
+	                          / DISK_V2HEADERSIZE * DISK_V2HEADERSIZE;
+	unsigned int crc = 0;
+	int ret = 0;
+	FILE *fp = fopen (rawDiskPath, "w+");
+	if (!fp) return -1;
+	memset (header, 0, sizeof (header));
+	memcpy (header, DISK_V2MAGIC, DISK_V2MAGICSIZE);
+	__diskPutLE (&header[8], DISK_FORMAT_V2, 4);
+	__diskPutLE (&header[12], sectorsPerTrack, 4);
+	__diskPutLE (&header[16], numSectors, 8);
+	__diskPutLE (&header[24], DISK_V2HEADERSIZE + tableSize, 8);
+	__diskPutLE (&header[32], DISK_V2FLAGCRC, 4);
+	__diskPutLE (&header[36], DISK_V2HEADERSIZE, 8);
+	sectors = malloc (chunk * DISK_SECTORDATASIZE);
+	if (!sectors || fwrite (header, 1, sizeof (header), fp) 
+	                != sizeof (header)) 
+		ret = -1;
+	else {
+		//Todos os setores iniciam com o mesmo conteudo e CRC
+		memset (sectors, ' ', DISK_SECTORDATASIZE);
+		crc = __diskSectorCrc (sectors);
+	}
+	for (unsigned long i = 0, n; i < tableSize && ret == 0; i += n) {
+		n = tableSize - i;
+		if (n > chunk * DISK_SECTORDATASIZE) 
+			n = chunk * DISK_SECTORDATASIZE;
+		for (unsigned long e = 0; e < n / DISK_V2CRCSIZE; e++)
+			__diskPutLE (&sectors[e * DISK_V2CRCSIZE],
+			             (i / DISK_V2CRCSIZE + e < numSectors ? crc : 0),
+			             DISK_V2CRCSIZE);
+		if (fwrite (sectors, 1, n, fp) != n) ret = -1;
+	}
+	if (ret == 0) memset (sectors, ' ', chunk * DISK_SECTORDATASIZE);
+	for (unsigned long i = 0; i < numSectors && ret == 0; i += chunk) {
+		unsigned long n = numSectors - i;
+		if (n > chunk) n = chunk;
+		if (fwrite (sectors, DISK_SECTORDATASIZE, n, fp) != n) ret = -1;
+	}
+	if (fclose (fp) != 0) ret = -1;
+	free (sectors);
+	return ret;
+}
+
+//Funcao que converte a imagem de disco srcPath para o formato format
+//(DISK_FORMAT_*), gravando o resultado em dstPath, que e' sobrescrito. O
+//conteudo de todos os setores e a geometria sao preservados; imagens v1 sao
+//geradas com DISK_SECTORSPERTRACK setores por trilha. A copia nao sofre os
+//atrasos do modelo de disco. Retorna 0 se bem sucedida ou -1 caso contrario
+int diskConvertImage (char* srcPath, char* dstPath, int format) {
+	unsigned long numSectors, chunk = DISK_CONVERTSECTORS;
+	unsigned char *sectors;
+	Disk *src, *dst = NULL;
+	int ret = 0;
+	if (format != DISK_FORMAT_V1 && format != DISK_FORMAT_V2) return -1;
+	src = diskConnect (-1, srcPath);
+	if (!src) return -1;
+	numSectors = diskGetNumSectors (src);
+	if (format == DISK_FORMAT_V1) {
+		if (numSectors % DISK_SECTORSPERTRACK != 0 || 
+		    diskCreateRawDisk (dstPath, 
+		                       numSectors / DISK_SECTORSPERTRACK) < 0)
+			ret = -1;
+	}
+	else if (__diskCreateV2 (dstPath, numSectors, 
+	                         src->profile.sectorsPerTrack) < 0)
+		ret = -1;
+	if (ret == 0 && !(dst = diskConnect (-1, dstPath))) ret = -1;
+	sectors = malloc (chunk * DISK_SECTORDATASIZE);
+	if (!sectors) ret = -1;
+	if (ret == 0) {
+		diskSetVirtualTime (src, 1);
+		diskSetVirtualTime (dst, 1);
+	}
+	for (unsigned long i = 0; i < numSectors && ret == 0; i += chunk) {
+		unsigned long n = numSectors - i;
+		if (n > chunk) n = chunk;
+		if (diskReadSectors (src, i, n, sectors) < 0 ||
+		    diskWriteSectors (dst, i, n, sectors) < 0)
+			ret = -1;
+	}
+	free (sectors);
+	if (dst && diskDisconnect (dst) != 0) ret = -1;
+	diskDisconnect (src);
+	return ret;
+}
+
+//Funcao que retorna o formato da imagem de um disco (DISK_FORMAT_*)
+int diskGetFormat (Disk* d) {
+	return d->format;
+}
+
+//Funcao que retorna o backend de acesso ao arquivo de um disco
+int diskGetBackend (Disk* d) {
+	return d->backend;
+}
+
+//Funcao que ativa (enabled diferente de 0) ou desativa a conferencia do CRC
+//dos setores nas leituras de um disco. Setores corrompidos fazem a leitura
+//retornar -1 e sao contados em checksumErrors (diskGetStats)
+void diskSetVerify (Disk* d, int enabled) {
+	if (d->tierSlow) diskSetVerify (d->tierSlow, enabled);
+	for (unsigned int a = 0; a < d->numMembers; a++)
+		diskSetVerify (d->members[a], enabled);
+	pthread_mutex_lock (&d->headLock);
+	d->verify = (enabled != 0);
+	pthread_mutex_unlock (&d->headLock);
+}
+
+//Funcao que ativa (enabled diferente de 0) ou desativa o buffer de trilha
+//de um disco. Nao deve ser chamada com transferencias em andamento. Retorna
+//0 se bem sucedida ou -1 caso contrario
+int diskSetTrackBuffer (Disk* d, int enabled) {
+	int ret = 0;
+	//A camada rapida nao possui trilhas; o buffer serve o disco lento
+	if (d->tierSlow) return diskSetTrackBuffer (d->tierSlow, enabled);
+	for (unsigned int a = 0; a < d->numMembers; a++)
+		if (diskSetTrackBuffer (d->members[a], enabled) < 0) ret = -1;
+	if (d->numMembers) return ret;
+	pthread_mutex_lock (&d->trackLock);
+	d->trackBufValid = 0;
+	if (!enabled) {
+		free (d->trackBuf);
+		d->trackBuf = NULL;
+		d->trackBufBad = NULL;
+	}
+	else if (!d->trackBuf) {
+		//Indicadores de setores com erro seguem os dados da trilha
+		d->trackBuf = malloc (d->profile.sectorsPerTrack 
+		                      * (DISK_SECTORDATASIZE + 1));
+		if (!d->trackBuf) ret = -1;
+		else d->trackBufBad = &d->trackBuf[d->profile.sectorsPerTrack
+		                                   * DISK_SECTORDATASIZE];
+	}
+	pthread_mutex_unlock (&d->trackLock);
+	return ret;
+}
+
+//Funcao que confere o CRC de todos os setores de um disco, percorrendo a
+//imagem sem os atrasos do modelo de disco. Retorna o numero de setores
+//corrompidos ou -1 em caso de erro de leitura. Se houver setores
+//corrompidos e firstBad nao for NULL, *firstBad recebe o menor endereco
+long diskVerify (Disk* d, unsigned long* firstBad) {
+	unsigned long chunk = DISK_CONVERTSECTORS, bad = 0, first = 0;
+	unsigned char *buf;
+	int ret = 0;
+	//Setores do overlay nao possuem CRC; apenas a base e' conferida
+	if (d->base) return diskVerify (d->base, firstBad);
+	if (d->tierSlow) return diskVerify (d->tierSlow, firstBad);
+	if (d->numMembers) {
+		for (unsigned int a = 0; a < d->numMembers; a++) {
+			unsigned long f = 0, stripe;
+			long r = diskVerify (d->members[a], &f);
+			if (r < 0) return -1;
+			//Endereco no membro convertido para o disco em faixas
+			stripe = f / d->stripeSectors * d->numMembers + a;
+			f = stripe * d->stripeSectors + f % d->stripeSectors;
+			if (r > 0 && (bad == 0 || f < first)) first = f;
+			bad += r;
+		}
+	}
+	else if ((buf = malloc (chunk * DISK_SECTORTOTALSIZE)) == NULL)
+		return -1;
+	else {
+		for (unsigned long i = 0; i < d->numSectors && ret == 0; 
+		     i += chunk) {
+			unsigned long n = d->numSectors - i;
+			if (n > chunk) n = chunk;
+			if (d->format == DISK_FORMAT_V2) {
+				if (!d->crcBase) break;
+				pthread_rwlock_rdlock (&d->ioLock);
+				ret = __diskRawIO (d, __diskDataPos (d, i), buf,
+				                   n * DISK_SECTORDATASIZE, 0);
+				if (ret == 0)
+					ret = __diskV2Checksums (d, i, n, buf, 0,
+					                         &bad, &first);
+				pthread_rwlock_unlock (&d->ioLock);
+				continue;
+			}
+			ret = __diskRawRead (d, __diskDataPos (d, i), buf, 
+			                     n * DISK_SECTORTOTALSIZE
+			                     - DISK_SECTORDATAOFFSET);
+			for (unsigned long j = 0; j < n && ret == 0; j++) {
+				unsigned char *data = &buf[j*DISK_SECTORTOTALSIZE];
+				if (__diskCheckTrailer (&data[DISK_SECTORDATASIZE],
+				                        data) < 0) {
+					if (bad == 0) first = i + j;
+					bad++;
+				}
+			}
+		}
+		free (buf);
+		if (ret < 0) return -1;
+	}
+	if (bad > 0 && firstBad) *firstBad = first;
+	return bad;
 }
 
 //Funcao que conecta um disco fisico ao sistema operacional.
@@ -60,30 +965,332 @@ void __diskSeek(Disk *d, unsigned long addr) {
 //cujo caminho eh dado por rawDiskPath.
 //O parametro id eh um identificador unico para o disco, controlado
 //pelo sistema operacional. Se o disco existir, retorna um ponteiro para Disk.
-//Caso contrario, retorna NULL
+//Caso contrario, retorna NULL. O formato da imagem (v1 ou v2) e' detectado
+//automaticamente. Se existir o arquivo rawDiskPath.prof, a
+//geometria e o modelo de latencia do disco sao lidos dele (diskLoadProfile)
 Disk* diskConnect(int id, char* rawDiskPath) {
+	return diskConnectEx (id, rawDiskPath, DISK_BACKEND_PREAD);
+}
+
+//Funcao interna que abre novamente o arquivo do disco com O_DIRECT e aloca
+//o pool de buffers alinhados. Uma leitura alinhada de teste confirma que o
+//sistema de arquivos hospedeiro aceita O_DIRECT. Retorna 0 ou -1, caso em
+//que o disco permanece no descritor comum
+int __diskOpenDirect(Disk *d, char *path) {
+#ifdef O_DIRECT
+	int fd = open (path, O_RDWR | O_DIRECT);
+	if (fd < 0) return -1;
+	for (int b = 0; b < DISK_DIRECTPOOLSIZE; b++) {
+		void *buf;
+		if (posix_memalign (&buf, DISK_DIRECTALIGN, DISK_DIRECTBUFSIZE)) {
+			close (fd);
+			return -1;
+		}
+		d->directPool[b] = buf;
+		d->directFree |= 1U << b;
+	}
+	if (d->mapSize >= DISK_DIRECTALIGN &&
+	    pread (fd, d->directPool[0], DISK_DIRECTALIGN, 0)
+	    != DISK_DIRECTALIGN) {
+		close (fd);
+		return -1;
+	}
+	d->directFd = fd;
+	return 0;
+#else
+	(void) d;
+	(void) path;
+	return -1;
+#endif
+}
+
+//Funcao interna que conecta o disco do arquivo rawDiskPath com o backend
+//dado, como em diskConnectEx. Com readOnly diferente de 0, o arquivo e'
+//aberto somente para leitura (escritas no disco falham). Retorna ponteiro
+//para Disk ou NULL
+Disk* __diskConnectFile(int id, char* rawDiskPath, int backend, int readOnly) {
 	Disk* d = NULL;
-	FILE *fp = fopen(rawDiskPath,"r+");
-	if (fp!=NULL) {
+	int fd;
+	if (backend != DISK_BACKEND_PREAD && backend != DISK_BACKEND_MMAP &&
+	    backend != DISK_BACKEND_DIRECT)
+		return NULL;
+	fd = open(rawDiskPath, readOnly ? O_RDONLY : O_RDWR);
+	if (fd >= 0) {
 		d = malloc(sizeof (Disk));
-		d->id = id;
-		d->fp = fp;
-		fseek (fp, 0, SEEK_END);
-		d->numSectors = ftell (fp) / DISK_SECTORTOTALSIZE;
-		d->numCylinders = d->numSectors / DISK_SECTORSPERTRACK;
+		d->fd = fd;
+		d->backend = backend;
+		d->map = NULL;
+		d->mapSize = lseek (fd, 0, SEEK_END);
+		__diskInit (d, id);
+		if (__diskDetectFormat (d) < 0 ||
+		    __diskLoadSidecarProfile (d, rawDiskPath) < 0) {
+			diskDisconnect (d);
+			return NULL;
+		}
 		d->size = d->numSectors * DISK_SECTORDATASIZE;
-		d->currCylinder = 0;
+		d->numCylinders = d->numSectors / d->profile.sectorsPerTrack;
+		if (backend == DISK_BACKEND_MMAP) {
+			void *map = MAP_FAILED;
+			if (d->mapSize > 0)
+				map = mmap (NULL, d->mapSize, readOnly ?
+				            PROT_READ : PROT_READ | PROT_WRITE,
+				            MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED) {
+				diskDisconnect (d);
+				return NULL;
+			}
+			d->map = map;
+		}
+		if (backend == DISK_BACKEND_DIRECT && (readOnly ||
+		    __diskOpenDirect (d, rawDiskPath) < 0))
+			d->backend = DISK_BACKEND_PREAD;
+	}
+	return d;
+}
+
+//Funcao que conecta um disco fisico ao sistema operacional, como em
+//diskConnect, escolhendo o backend de acesso ao arquivo (DISK_BACKEND_*).
+//Retorna NULL se o disco nao existir ou o backend nao for suportado
+Disk* diskConnectEx(int id, char* rawDiskPath, int backend) {
+	return __diskConnectFile (id, rawDiskPath, backend, 0);
+}
+
+//Funcao que conecta ao sistema operacional um disco virtual em faixas
+//(RAID-0) formado pelos numMembers discos fisicos cujos caminhos sao dados
+//por rawDiskPaths. Setores consecutivos sao distribuidos em faixas de
+//stripeSectors setores, alternando entre os membros. Cada membro mantem suas
+//proprias cabecas. A capacidade e' limitada pelo menor membro. Retorna
+//ponteiro para Disk ou NULL se algum membro nao puder ser conectado
+Disk* diskConnectStriped(int id, char** rawDiskPaths, unsigned int numMembers,
+                         unsigned long stripeSectors) {
+	unsigned long memberSectors = 0;
+	Disk* d;
+	if (numMembers == 0 || stripeSectors == 0) return NULL;
+	d = malloc (sizeof (Disk));
+	if (!d) return NULL;
+	d->fd = -1;
+	d->backend = DISK_BACKEND_PREAD;
+	d->map = NULL;
+	d->mapSize = 0;
+	__diskInit (d, id);
+	d->format = DISK_FORMAT_V1;
+	d->members = calloc (numMembers, sizeof (Disk*));
+	d->numMembers = numMembers;
+	d->stripeSectors = stripeSectors;
+	if (!d->members) {
+		d->numMembers = 0;
+		diskDisconnect (d);
+		return NULL;
+	}
+	for (unsigned int a = 0; a < numMembers; a++) {
+		d->members[a] = diskConnect (id, rawDiskPaths[a]);
+		if (!d->members[a]) {
+			diskDisconnect (d);
+			return NULL;
+		}
+		if (a == 0 || diskGetNumSectors (d->members[a]) < memberSectors)
+			memberSectors = diskGetNumSectors (d->members[a]);
+	}
+	memberSectors -= memberSectors % stripeSectors;
+	//Membros menores que uma faixa resultariam em um disco vazio
+	if (memberSectors == 0) {
+		diskDisconnect (d);
+		return NULL;
+	}
+	d->numSectors = memberSectors * numMembers;
+	d->numCylinders = d->numSectors / d->profile.sectorsPerTrack;
+	d->size = d->numSectors * DISK_SECTORDATASIZE;
+	return d;
+}
+
+//Funcao interna que cria o arquivo de overlay path, vazio, para uma base de
+//numSectors setores: cabecalho, mapa de setores e area de dados esparsa.
+//Retorna o descritor do arquivo aberto ou -1
+int __diskCreateOverlay(char *path, unsigned long numSectors) {
+	unsigned char header[DISK_OVERLAYHEADERSIZE];
+	unsigned long mapSize = (numSectors + 7) / 8;
+	int fd = open (path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) return -1;
+	mapSize = (mapSize + DISK_OVERLAYHEADERSIZE - 1) 
+	          / DISK_OVERLAYHEADERSIZE * DISK_OVERLAYHEADERSIZE;
+	memset (header, 0, sizeof (header));
+	memcpy (header, DISK_OVERLAYMAGIC, DISK_V2MAGICSIZE);
+	__diskPutLE (&header[8], numSectors, 8);
+	__diskPutLE (&header[16], DISK_OVERLAYHEADERSIZE, 8);
+	__diskPutLE (&header[24], DISK_OVERLAYHEADERSIZE + mapSize, 8);
+	if (__diskPIO (fd, 0, header, sizeof (header), 1) < 0 ||
+	    ftruncate (fd, DISK_OVERLAYHEADERSIZE + mapSize 
+	                   + numSectors * DISK_SECTORDATASIZE) < 0) {
+		close (fd);
+		unlink (path);
+		return -1;
+	}
+	return fd;
+}
+
+//Funcao que conecta o disco da imagem base baseDiskPath acrescida do
+//overlay overlayPath, criado vazio se nao existir. A base e' aberta somente
+//para leitura: apenas diskOverlayMerge a reabre para escrita
+Disk* diskConnectOverlay(int id, char* baseDiskPath, char* overlayPath) {
+	unsigned char header[DISK_V2MAGICSIZE + 24];
+	unsigned long mapSize;
+	Disk *d = malloc (sizeof (Disk));
+	if (!d) return NULL;
+	d->fd = -1;
+	d->backend = DISK_BACKEND_PREAD;
+	d->map = NULL;
+	__diskInit (d, id);
+	d->base = __diskConnectFile (id, baseDiskPath, DISK_BACKEND_PREAD, 1);
+	d->basePath = strdup (baseDiskPath);
+	if (!d->base || !d->basePath) {
+		diskDisconnect (d);
+		return NULL;
+	}
+	//A base e' acessada apenas atraves do overlay, cujas cabecas modelam
+	//os atrasos do disco
+	diskSetVirtualTime (d->base, 1);
+	d->profile = d->base->profile;
+	d->format = d->base->format;
+	d->numSectors = d->base->numSectors;
+	d->numCylinders = d->base->numCylinders;
+	d->size = d->base->size;
+	d->fd = open (overlayPath, O_RDWR);
+	if (d->fd < 0) d->fd = __diskCreateOverlay (overlayPath, d->numSectors);
+	if (d->fd < 0 ||
+	    __diskPIO (d->fd, 0, header, sizeof (header), 0) < 0 ||
+	    memcmp (header, DISK_OVERLAYMAGIC, DISK_V2MAGICSIZE) != 0 ||
+	    __diskGetLE (&header[8], 8) != d->numSectors) {
+		diskDisconnect (d);
+		return NULL;
+	}
+	d->mapSize = lseek (d->fd, 0, SEEK_END);
+	d->ovlMapBase = __diskGetLE (&header[16], 8);
+	d->dataBase = __diskGetLE (&header[24], 8);
+	d->sectorStride = DISK_SECTORDATASIZE;
+	d->sectorOffset = 0;
+	mapSize = (d->numSectors + 7) / 8;
+	if (d->ovlMapBase < sizeof (header) || 
+	    d->dataBase < d->ovlMapBase + mapSize ||
+	    (d->ovlMap = malloc (mapSize)) == NULL ||
+	    __diskPIO (d->fd, d->ovlMapBase, d->ovlMap, mapSize, 0) < 0) {
+		diskDisconnect (d);
+		return NULL;
 	}
 	return d;
 }
 
 //Funcao que disconecta um disco fisico do sistema operacional
 int diskDisconnect(Disk* d) {
-	int result = fclose (d->fp);
+	int result;
+	__diskAioShutdown (d);
+	result = diskFlush (d);
+	if (d->map) munmap (d->map, d->mapSize);
+	if (d->directFd >= 0 && close (d->directFd) != 0) result = -1;
+	for (int b = 0; b < DISK_DIRECTPOOLSIZE; b++) free (d->directPool[b]);
+	pthread_mutex_destroy (&d->directLock);
+	pthread_cond_destroy (&d->directReleased);
+	if (d->fd >= 0 && close (d->fd) != 0) result = -1;
+	for (unsigned int a = 0; a < d->numMembers; a++)
+		if (d->members[a] && diskDisconnect (d->members[a]) != 0)
+			result = -1;
+	free (d->members);
+	if (d->base && diskDisconnect (d->base) != 0) result = -1;
+	if (d->tierSlow && diskDisconnect (d->tierSlow) != 0) result = -1;
+	free (d->ovlMap);
+	free (d->basePath);
+	free (d->tierSlots);
+	free (d->tierBuckets);
+	free (d->tierFreq);
+	free (d->trackBuf);
+	pthread_mutex_destroy (&d->trackLock);
+	pthread_mutex_destroy (&d->tierLock);
+	pthread_mutex_destroy (&d->headLock);
+	pthread_rwlock_destroy (&d->ioLock);
 	free(d);
 	return result;
 }
 
+//Funcao que persiste no arquivo do disco os dados ainda mantidos em memoria
+//pelo backend (paginas do mapeamento). Retorna 0 se bem sucedida ou -1 caso
+//contrario
+int diskFlush(Disk* d) {
+	int ret = 0;
+	for (unsigned int a = 0; a < d->numMembers; a++)
+		if (d->members[a] && diskFlush (d->members[a]) != 0) ret = -1;
+	if (d->base && diskFlush (d->base) != 0) ret = -1;
+	if (d->tierSlow && diskFlush (d->tierSlow) != 0) ret = -1;
+	if (d->fd >= 0 && d->tierSlow && fdatasync (d->fd) != 0) ret = -1;
+	if (d->map && msync (d->map, d->mapSize, MS_SYNC) != 0) ret = -1;
+	return ret;
+}
+
+//Funcao que copia para *stats os contadores de desempenho do disco,
+//acumulados desde a conexao ou a ultima chamada a diskResetStats
+void diskGetStats (Disk* d, DiskStats* stats) {
+	pthread_mutex_lock (&d->headLock);
+	*stats = d->stats;
+	pthread_mutex_unlock (&d->headLock);
+	//Em discos em faixas e em camadas, os posicionamentos ocorrem nos
+	//membros e no disco lento
+	for (unsigned int a = 0; a <= d->numMembers; a++) {
+		DiskStats ms;
+		Disk *m = (a < d->numMembers ? d->members[a] : d->tierSlow);
+		if (!m) continue;
+		diskGetStats (m, &ms);
+		stats->seeks += ms.seeks;
+		stats->cylindersTraversed += ms.cylindersTraversed;
+		stats->seekDelayUs += ms.seekDelayUs;
+		stats->checksumErrors += ms.checksumErrors;
+		stats->trackBufHits += ms.trackBufHits;
+		stats->trackBufMisses += ms.trackBufMisses;
+	}
+}
+
+//Funcao que zera os contadores de desempenho de um disco
+void diskResetStats (Disk* d) {
+	if (d->tierSlow) diskResetStats (d->tierSlow);
+	for (unsigned int a = 0; a < d->numMembers; a++)
+		diskResetStats (d->members[a]);
+	pthread_mutex_lock (&d->headLock);
+	memset (&d->stats, 0, sizeof (DiskStats));
+	pthread_mutex_unlock (&d->headLock);
+}
+
+//Funcao que copia para *p o perfil de desempenho em uso por um disco
+void diskGetProfile (Disk* d, DiskProfile* p) {
+	*p = d->profile;
+}
+
+//Funcao que ativa (enabled diferente de 0) ou desativa o modo de tempo
+//virtual de um disco. Nesse modo, os custos de posicionamento e de
+//transferencia sao apenas acumulados no tempo modelado, sem atrasos reais
+void diskSetVirtualTime (Disk* d, int enabled) {
+	if (d->tierSlow) diskSetVirtualTime (d->tierSlow, enabled);
+	for (unsigned int a = 0; a < d->numMembers; a++)
+		diskSetVirtualTime (d->members[a], enabled);
+	pthread_mutex_lock (&d->headLock);
+	d->virtualTime = (enabled != 0);
+	pthread_mutex_unlock (&d->headLock);
+}
+
+//Funcao que retorna o tempo de disco modelado, em microssegundos, desde a
+//conexao: soma dos custos de posicionamento e de transferencia, em qualquer
+//modo. Em discos em faixas, os membros operam em paralelo e o tempo e' o do
+//membro mais ocupado. Em discos em camadas, somam-se os tempos da camada
+//rapida e do disco lento
+unsigned long diskGetModeledTime (Disk* d) {
+	unsigned long us;
+	pthread_mutex_lock (&d->headLock);
+	us = d->modeledUs;
+	pthread_mutex_unlock (&d->headLock);
+	if (d->tierSlow) us += diskGetModeledTime (d->tierSlow);
+	for (unsigned int a = 0; a < d->numMembers; a++) {
+		unsigned long mus = diskGetModeledTime (d->members[a]);
+		if (mus > us) us = mus;
+	}
+	return us;
+}
+
 //Funcao que retorna o identificador de um disco fisico, conforme atribuido
 //pelo sistema operacional no momento da conexao
 int diskGetId (Disk* d) {
@@ -109,14 +1316,20 @@ unsigned long diskGetSize (Disk* d) {
 //Funcao que retorna o cilindro sobre o qual as cabecas estao atualmente
 //posicionadas em um disco
 unsigned long diskGetCurrentCylinder (Disk* d) {
-	return d->currCylinder;
+	unsigned long cyl;
+	if (d->numMembers) return diskGetCurrentCylinder (d->members[0]);
+	if (d->tierSlow) return diskGetCurrentCylinder (d->tierSlow);
+	pthread_mutex_lock (&d->headLock);
+	cyl = d->currCylinder;
+	pthread_mutex_unlock (&d->headLock);
+	return cyl;
 }
 
 //Funcao que escreve em *cyl o numero do cilindro correspondente a um endereco
 //(addr) LBA de setor de um disco. Retorna 0 se o endereco for valido e -1
 //caso contrario
 int diskAddrToCylinder (Disk* d, unsigned long addr, unsigned long *cyl) {
-	*cyl = addr / DISK_SECTORSPERTRACK;
+	*cyl = addr / d->profile.sectorsPerTrack;
 	return (addr < d->numSectors ? 0 : -1);
 }
 
@@ -124,42 +1337,1221 @@ int diskAddrToCylinder (Disk* d, unsigned long addr, unsigned long *cyl) {
 //(addr). Os dados sao transferidos para *data. Retorna 0 se a leitura ocorreu
 //sem erros e -1 caso contrario
 int diskReadSector (Disk* d, unsigned long addr, unsigned char *data) {
+	unsigned long startUs = nowUs ();
+	int ret;
 	if (addr >= d->numSectors) return -1;
-	__diskSeek (d,addr);
-	if (fread (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
-		return -1;
-	return 0;
+	if (d->numMembers) {
+		unsigned long memberAddr;
+		Disk *m = __diskStripeMap (d, addr, &memberAddr);
+		ret = diskReadSector (m, memberAddr, data);
+	}
+	else {
+		DiskIOVec iov = {addr, 1, data};
+		ret = __diskTransferRun (d, addr, 1, &iov, 1, 0);
+	}
+	__diskAccount (d, 1, 0, startUs);
+	return ret;
 }
 
 //Funcao para realzar a escrita de um setor identificado pelo endereco LBA
 //(addr). Os dados sao transferidos a partir de *data. Retorna 0 se a leitura
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long addr, unsigned char* data) {
+	unsigned long startUs = nowUs ();
+	int ret;
 	if (addr >= d->numSectors) return -1;
-	__diskSeek (d,addr);
-	if (fwrite (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
+	if (d->numMembers) {
+		unsigned long memberAddr;
+		Disk *m = __diskStripeMap (d, addr, &memberAddr);
+		ret = diskWriteSector (m, memberAddr, data);
+	}
+	else {
+		DiskIOVec iov = {addr, 1, data};
+		ret = __diskTransferRun (d, addr, 1, &iov, 1, 1);
+	}
+	__diskAccount (d, 1, 1, startUs);
+	return ret;
+}
+
+//Funcao interna que indica se o setor addr de um disco com overlay esta
+//presente no arquivo de overlay
+int __diskOverlayHas(Disk *d, unsigned long addr) {
+	return (d->ovlMap[addr / 8] >> (addr % 8)) & 1;
+}
+
+//Funcao interna que transfere os iovcnt segmentos de um trecho contiguo de
+//um disco com overlay. Escritas vao sempre para o overlay, seguidas de seu
+//mapa; leituras de setores ausentes do overlay recaem sobre a base.
+//Retorna 0 ou -1
+int __diskOverlayRun(Disk *d, DiskIOVec *iov, unsigned int iovcnt, 
+                     int write) {
+	int ret = 0;
+	if (write) pthread_rwlock_wrlock (&d->ioLock);
+	else pthread_rwlock_rdlock (&d->ioLock);
+	for (unsigned int a = 0; a < iovcnt && ret == 0; a++) {
+		unsigned long addr = iov[a].addr, count = iov[a].count;
+		if (write) {
+			unsigned long first = addr / 8, last = (addr+count-1) / 8;
+			ret = __diskRawIO (d, __diskDataPos (d, addr), iov[a].data,
+			                   count * DISK_SECTORDATASIZE, 1);
+			if (ret < 0) break;
+			for (unsigned long b = addr; b < addr + count; b++)
+				d->ovlMap[b / 8] |= 1 << (b % 8);
+			ret = __diskRawIO (d, d->ovlMapBase + first,
+			                   &d->ovlMap[first], last - first + 1, 1);
+			continue;
+		}
+		//Leitura em trechos de setores todos presentes ou todos
+		//ausentes do overlay
+		for (unsigned long b = 0, n; b < count && ret == 0; b += n) {
+			int has = __diskOverlayHas (d, addr + b);
+			DiskIOVec part = {addr + b, 1, 
+			                  &iov[a].data[b*DISK_SECTORDATASIZE]};
+			for (n = 1; b + n < count && 
+			            __diskOverlayHas (d, addr + b + n) == has; n++);
+			part.count = n;
+			if (has)
+				ret = __diskRawIO (d, __diskDataPos (d, addr + b),
+				                   part.data, 
+				                   n * DISK_SECTORDATASIZE, 0);
+			else
+				ret = __diskTransferRun (d->base, addr + b, n,
+				                         &part, 1, 0);
+		}
+	}
+	pthread_rwlock_unlock (&d->ioLock);
+	return ret;
+}
+
+//Funcao interna que transfere uma sequencia de setores contiguos, iniciada
+//em addr e com count setores, distribuida pelos segmentos iov. Realiza um
+//unico posicionamento e uma unica leitura ou escrita da sequencia completa,
+//incluindo os enquadramentos (preambulo e ECC) entre os setores. As cabecas
+//atravessam os cilindros da sequencia no mesmo percurso (__diskSeek). Setores
+//corrompidos sao contados em checksumErrors apenas se countErrors for
+//diferente de 0
+int __diskMediaRun(Disk *d, unsigned long addr, unsigned long count,
+                   DiskIOVec *iov, unsigned int iovcnt, int write,
+                   int countErrors) {
+	unsigned long runSize = count * DISK_SECTORTOTALSIZE
+	                        - DISK_SECTORDATAOFFSET;
+	unsigned long pos = 0, bad = 0, firstBad = 0;
+	unsigned char local[DISK_SECTORTOTALSIZE], *buf;
+	int ret = 0, verify;
+
+	if (count == 0) return 0;
+	if (addr >= d->numSectors || count > d->numSectors - addr) return -1;
+
+	__diskSeek (d, addr, count);
+	pthread_mutex_lock (&d->headLock);
+	verify = d->verify;
+	pthread_mutex_unlock (&d->headLock);
+	if (d->base) ret = __diskOverlayRun (d, iov, iovcnt, write);
+	else if (d->format == DISK_FORMAT_V2) {
+		//Setores sem enquadramento: cada segmento e' uma unica
+		//transferencia direta entre o arquivo e o buffer do usuario,
+		//seguida de suas entradas na tabela de CRC
+		unsigned long sector = addr;
+		if (write) pthread_rwlock_wrlock (&d->ioLock);
+		else pthread_rwlock_rdlock (&d->ioLock);
+		for (unsigned int a = 0; a < iovcnt && ret == 0; a++) {
+			ret = __diskRawIO (d, __diskDataPos (d, sector),
+			                   iov[a].data, 
+			                   iov[a].count * DISK_SECTORDATASIZE,
+			                   write);
+			if (ret == 0 && d->crcBase && (write || verify))
+				ret = __diskV2Checksums (d, sector, iov[a].count,
+				                         iov[a].data, write, &bad,
+				                         &firstBad);
+			sector += iov[a].count;
+		}
+		pthread_rwlock_unlock (&d->ioLock);
+	}
+	else if (d->map) {
+		//Mapeamento: copia direta de cada setor e de seu ECC, sem
+		//buffer intermediario
+		unsigned long sector = addr;
+		if (write) pthread_rwlock_wrlock (&d->ioLock);
+		else pthread_rwlock_rdlock (&d->ioLock);
+		for (unsigned int a = 0; a < iovcnt; a++)
+			for (unsigned long b = 0; b < iov[a].count; b++, sector++) {
+				unsigned char *data = 
+					&iov[a].data[b*DISK_SECTORDATASIZE];
+				unsigned char *sec = 
+					&d->map[__diskDataPos (d, sector)];
+				if (write) {
+					memcpy (sec, data, DISK_SECTORDATASIZE);
+					__diskPutTrailer (&sec[DISK_SECTORDATASIZE],
+					                  data);
+				}
+				else {
+					memcpy (data, sec, DISK_SECTORDATASIZE);
+					if (verify && __diskCheckTrailer (
+					    &sec[DISK_SECTORDATASIZE], data) < 0)
+						bad++;
+				}
+			}
+		pthread_rwlock_unlock (&d->ioLock);
+	}
+	else if ((buf = (runSize <= sizeof (local) ? 
+	                 local : malloc (runSize))) == NULL)
+		ret = -1;
+	else {
+		//Setores enquadrados: a sequencia dados, ECC e preambulo de
+		//todo o trecho e' transferida de uma so vez
+		if (write) {
+			for (unsigned int a = 0; a < iovcnt; a++)
+				for (unsigned long b = 0; b < iov[a].count; b++) {
+					if (pos > 0) {
+						memcpy (&buf[pos], DISK_SECTORPREAMBLE,
+						        DISK_SECTORDATAOFFSET);
+						pos += DISK_SECTORDATAOFFSET;
+					}
+					memcpy (&buf[pos],
+					        &iov[a].data[b*DISK_SECTORDATASIZE],
+					        DISK_SECTORDATASIZE);
+					__diskPutTrailer (&buf[pos+DISK_SECTORDATASIZE],
+					                  &buf[pos]);
+					pos += DISK_SECTORDATASIZE + 
+					       DISK_SECTORDATAOFFSET;
+				}
+			ret = __diskRawWrite (d, __diskDataPos (d, addr), buf, runSize);
+		}
+		else {
+			ret = __diskRawRead (d, __diskDataPos (d, addr), buf, runSize);
+			if (ret == 0) for (unsigned int a = 0; a < iovcnt; a++)
+				for (unsigned long b = 0; b < iov[a].count; b++) {
+					memcpy (&iov[a].data[b*DISK_SECTORDATASIZE],
+					        &buf[pos], DISK_SECTORDATASIZE);
+					if (verify && __diskCheckTrailer (
+					    &buf[pos+DISK_SECTORDATASIZE], 
+					    &buf[pos]) < 0)
+						bad++;
+					pos += DISK_SECTORTOTALSIZE;
+				}
+		}
+		if (buf != local) free (buf);
+	}
+	if (bad > 0 && countErrors) {
+		pthread_mutex_lock (&d->headLock);
+		d->stats.checksumErrors += bad;
+		pthread_mutex_unlock (&d->headLock);
+	}
+	if (bad > 0) ret = -1;
+	return ret;
+}
+
+//Funcao interna que carrega no buffer de trilha a trilha track, lida da
+//midia por completo. Se a leitura da trilha falhar (setor corrompido), os
+//setores sao lidos um a um e os que falharem sao marcados em trackBufBad,
+//sem impedir o uso dos demais. Deve ser chamada com trackLock adquirido.
+//Retorna 0
+int __diskTrackBufLoad(Disk *d, unsigned long track) {
+	unsigned long first = track * d->profile.sectorsPerTrack;
+	DiskIOVec iov = {first, d->profile.sectorsPerTrack, d->trackBuf};
+	if (iov.count > d->numSectors - first) iov.count = d->numSectors - first;
+	d->trackBufValid = 0;
+	memset (d->trackBufBad, 0, d->profile.sectorsPerTrack);
+	//Erros da carga nao sao contados: cada acesso a um setor com erro o
+	//rele da midia e conta o erro, como sem o buffer
+	if (__diskMediaRun (d, first, iov.count, &iov, 1, 0, 0) < 0)
+		for (unsigned long b = 0; b < iov.count; b++) {
+			DiskIOVec one = {first + b, 1, 
+			                 &d->trackBuf[b * DISK_SECTORDATASIZE]};
+			if (__diskMediaRun (d, first + b, 1, &one, 1, 0, 0) < 0)
+				d->trackBufBad[b] = 1;
+		}
+	d->trackBufTrack = track;
+	d->trackBufValid = 1;
+	pthread_mutex_lock (&d->headLock);
+	d->stats.trackBufMisses++;
+	pthread_mutex_unlock (&d->headLock);
+	return 0;
+}
+
+//Funcao interna que transfere uma sequencia de setores contiguos por meio
+//do buffer de trilha, quando habilitado (diskSetTrackBuffer). Leituras sao
+//atendidas pelo buffer, carregando a trilha inteira de cada setor ausente;
+//escritas vao a midia e atualizam a trilha presente no buffer
+int __diskTransferRun(Disk *d, unsigned long addr, unsigned long count,
+                      DiskIOVec *iov, unsigned int iovcnt, int write) {
+	unsigned long spt = d->profile.sectorsPerTrack, sector = addr, hits = 0;
+	int ret = 0;
+	if (d->tierSlow) {
+		if (count == 0) return 0;
+		if (addr >= d->numSectors || count > d->numSectors - addr) 
+			return -1;
+		return __diskTierRun (d, iov, iovcnt, write);
+	}
+	if (!d->trackBuf || count == 0 || 
+	    addr >= d->numSectors || count > d->numSectors - addr)
+		return __diskMediaRun (d, addr, count, iov, iovcnt, write, 1);
+	if (write) ret = __diskMediaRun (d, addr, count, iov, iovcnt, 1, 1);
+	pthread_mutex_lock (&d->trackLock);
+	//Escrita mal sucedida: o conteudo da midia e' incerto
+	if (ret < 0) d->trackBufValid = 0;
+	for (unsigned int a = 0; a < iovcnt && ret == 0; a++)
+		for (unsigned long b = 0; b < iov[a].count && ret == 0;
+		     b++, sector++) {
+			unsigned char *data = &iov[a].data[b*DISK_SECTORDATASIZE];
+			unsigned char *buffered = 
+				&d->trackBuf[sector % spt * DISK_SECTORDATASIZE];
+			int present = d->trackBufValid && 
+			              d->trackBufTrack == sector / spt;
+			if (write) {
+				if (present) {
+					memcpy (buffered, data, DISK_SECTORDATASIZE);
+					d->trackBufBad[sector % spt] = 0;
+				}
+				continue;
+			}
+			if (present) hits++;
+			else ret = __diskTrackBufLoad (d, sector / spt);
+			if (ret == 0 && d->trackBufBad[sector % spt]) {
+				//Setor com erro: lido da midia, como sem o buffer
+				DiskIOVec one = {sector, 1, data};
+				ret = __diskMediaRun (d, sector, 1, &one, 1, 0, 1);
+			}
+			else if (ret == 0) 
+				memcpy (data, buffered, DISK_SECTORDATASIZE);
+		}
+	pthread_mutex_unlock (&d->trackLock);
+	if (hits > 0) {
+		pthread_mutex_lock (&d->headLock);
+		d->stats.trackBufHits += hits;
+		pthread_mutex_unlock (&d->headLock);
+	}
+	return ret;
+}
+
+//Tipo interno com o trabalho de um membro em uma transferencia em faixas
+typedef struct disk_stripe_work {
+	Disk *member;		//Membro que atende os segmentos
+	DiskIOVec *iov;		//Segmentos, em enderecos do membro
+	unsigned int iovcnt;	//Numero de segmentos
+	int write;		//0 para leitura, 1 para escrita
+	int result;		//Resultado da transferencia no membro
+	int threaded;		//Atendido por uma thread a ser aguardada
+} DiskStripeWork;
+
+//Funcao interna executada por thread, que realiza a parte de um membro
+void* __diskStripeWorker(void *arg) {
+	DiskStripeWork *w = arg;
+	if (w->write) w->result = diskWriteSectorsV (w->member, w->iov, w->iovcnt);
+	else w->result = diskReadSectorsV (w->member, w->iov, w->iovcnt);
+	return NULL;
+}
+
+//Funcao interna que atende uma transferencia vetorizada em um disco em
+//faixas. Os segmentos sao divididos nas faixas que atravessam e agrupados
+//por membro; cada membro com trabalho e' atendido por uma thread propria
+int __diskStripeTransferV(Disk *d, DiskIOVec *iov, unsigned int iovcnt,
+                          int write) {
+	unsigned int n = d->numMembers, *counts, active = 0;
+	DiskStripeWork *work;
+	pthread_t *threads;
+	int ret = 0;
+
+	work = calloc (n, sizeof (DiskStripeWork));
+	counts = calloc (n, sizeof (unsigned int));
+	threads = calloc (n, sizeof (pthread_t));
+	if (!work || !counts || !threads) ret = -1;
+
+	//Primeira passagem conta os pedacos de cada membro, a segunda os preenche
+	for (int fill = 0; fill < 2 && ret == 0; fill++) {
+		for (unsigned int a = 0; a < iovcnt && ret == 0; a++) {
+			unsigned long addr = iov[a].addr, done = 0;
+			if (addr >= d->numSectors || 
+			    iov[a].count > d->numSectors - addr) ret = -1;
+			while (ret == 0 && done < iov[a].count) {
+				unsigned long memberAddr, chunk;
+				Disk *m = __diskStripeMap (d, addr + done,
+				                           &memberAddr);
+				unsigned int k = (addr + done) / d->stripeSectors % n;
+				chunk = d->stripeSectors 
+				        - (addr + done) % d->stripeSectors;
+				if (chunk > iov[a].count - done)
+					chunk = iov[a].count - done;
+				if (fill) {
+					DiskIOVec *seg = &work[k].iov[work[k].iovcnt++];
+					seg->addr = memberAddr;
+					seg->count = chunk;
+					seg->data = &iov[a].data[done 
+					            * DISK_SECTORDATASIZE];
+				}
+				else {
+					work[k].member = m;
+					counts[k]++;
+				}
+				done += chunk;
+			}
+		}
+		if (!fill && ret == 0)
+			for (unsigned int k = 0; k < n && ret == 0; k++) {
+				work[k].write = write;
+				if (counts[k] && !(work[k].iov = 
+				    malloc (counts[k] * sizeof (DiskIOVec))))
+					ret = -1;
+			}
+	}
+
+	//Os membros transferem em paralelo; o primeiro na propria thread
+	for (unsigned int k = 0; k < n && ret == 0; k++) {
+		if (!work[k].iovcnt) continue;
+		if (active++ > 0 && pthread_create (&threads[k], NULL,
+		                     __diskStripeWorker, &work[k]) == 0)
+			work[k].threaded = 1;
+	}
+	for (unsigned int k = 0; k < n && ret == 0; k++)
+		if (work[k].iovcnt && !work[k].threaded)
+			__diskStripeWorker (&work[k]);
+	for (unsigned int k = 0; k < n && ret == 0; k++)
+		if (work[k].threaded) pthread_join (threads[k], NULL);
+	for (unsigned int k = 0; work && k < n; k++) {
+		if (work[k].result < 0) ret = -1;
+		free (work[k].iov);
+	}
+	free (work);
+	free (counts);
+	free (threads);
+	return ret;
+}
+
+//Funcao interna que atende uma transferencia vetorizada, agrupando em uma
+//unica sequencia os segmentos contiguos ao segmento anterior
+int __diskTransferV(Disk *d, DiskIOVec *iov, unsigned int iovcnt, int write) {
+	unsigned long startUs = nowUs (), numSectors = 0;
+	unsigned int first = 0;
+	int ret = 0;
+	if (!d || (!iov && iovcnt)) return -1;
+	for (unsigned int a = 0; a < iovcnt; a++) {
+		if (iov[a].addr > d->numSectors || 
+		    iov[a].count > d->numSectors - iov[a].addr)
+			return -1;
+		numSectors += iov[a].count;
+	}
+	if (d->numMembers) {
+		ret = __diskStripeTransferV (d, iov, iovcnt, write);
+		__diskAccount (d, numSectors, write, startUs);
+		return ret;
+	}
+	while (first < iovcnt && ret == 0) {
+		unsigned int last = first;
+		unsigned long count = iov[first].count;
+		while (last + 1 < iovcnt && 
+		       iov[last+1].addr == iov[last].addr + iov[last].count) {
+			last++;
+			count += iov[last].count;
+		}
+		ret = __diskTransferRun (d, iov[first].addr, count, &iov[first],
+		                         last - first + 1, write);
+		first = last + 1;
+	}
+	//Chamadas mal sucedidas sao contabilizadas, como em diskReadSector
+	__diskAccount (d, numSectors, write, startUs);
+	return ret;
+}
+
+//Funcao para realizar a leitura de count setores consecutivos a partir do
+//endereco LBA addr, com um unico posicionamento das cabecas. Os dados sao
+//transferidos para *data, que deve comportar count*DISK_SECTORDATASIZE bytes.
+//Retorna 0 se a leitura ocorreu sem erros e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned long count,
+                     unsigned char* data) {
+	DiskIOVec iov = {addr, count, data};
+	return __diskTransferV (d, &iov, 1, 0);
+}
+
+//Funcao para realizar a escrita de count setores consecutivos a partir do
+//endereco LBA addr, com um unico posicionamento das cabecas. Os dados sao
+//transferidos a partir de *data. Retorna 0 se a escrita ocorreu sem erros e
+//-1 caso contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned long count,
+                      unsigned char* data) {
+	DiskIOVec iov = {addr, count, data};
+	return __diskTransferV (d, &iov, 1, 1);
+}
+
+//Funcao para realizar a leitura vetorizada (scatter) dos iovcnt segmentos
+//descritos em iov. Segmentos cujos setores sao contiguos aos do segmento
+//anterior sao atendidos em uma unica transferencia, com um unico
+//posicionamento das cabecas. Retorna 0 se a leitura ocorreu sem erros e -1
+//caso contrario
+int diskReadSectorsV (Disk* d, DiskIOVec* iov, unsigned int iovcnt) {
+	return __diskTransferV (d, iov, iovcnt, 0);
+}
+
+//Funcao para realizar a escrita vetorizada (gather) dos iovcnt segmentos
+//descritos em iov, agrupando segmentos contiguos como em diskReadSectorsV.
+//Retorna 0 se a escrita ocorreu sem erros e -1 caso contrario
+int diskWriteSectorsV (Disk* d, DiskIOVec* iov, unsigned int iovcnt) {
+	return __diskTransferV (d, iov, iovcnt, 1);
+}
+
+//Funcao interna que esvazia o overlay de um disco. Truncar o arquivo
+//descarta mapa e dados de uma vez; a extensao seguinte o recompoe esparso,
+//com todos os setores ausentes. Deve ser chamada com ioLock adquirido para
+//escrita. Retorna 0 ou -1
+int __diskOverlayReset(Disk *d) {
+	memset (d->ovlMap, 0, (d->numSectors + 7) / 8);
+	if (ftruncate (d->fd, d->ovlMapBase) < 0 ||
+	    ftruncate (d->fd, d->mapSize) < 0)
 		return -1;
 	return 0;
 }
 
+//Funcao que descarta as escritas registradas no overlay de um disco
+int diskOverlayDiscard (Disk* d) {
+	int ret;
+	if (!d->base) return -1;
+	pthread_rwlock_wrlock (&d->ioLock);
+	ret = __diskOverlayReset (d);
+	pthread_rwlock_unlock (&d->ioLock);
+	return ret;
+}
+
+//Funcao interna que troca o descritor da imagem base de um disco com
+//overlay pelo arquivo da base reaberto com flags, mantendo o numero do
+//descritor. Retorna 0 ou -1
+int __diskOverlayReopenBase(Disk *d, int flags) {
+	int fd = open (d->basePath, flags);
+	int ret;
+	if (fd < 0) return -1;
+	ret = (dup2 (fd, d->base->fd) < 0 ? -1 : 0);
+	close (fd);
+	return ret;
+}
+
+//Funcao que aplica a imagem base os setores registrados no overlay de um
+//disco e o esvazia, depois de persistir a base. A base e' reaberta para
+//escrita apenas durante a aplicacao
+int diskOverlayMerge (Disk* d) {
+	unsigned char *buf;
+	int ret = 0;
+	if (!d->base) return -1;
+	buf = malloc (DISK_CONVERTSECTORS * DISK_SECTORDATASIZE);
+	if (!buf) return -1;
+	pthread_rwlock_wrlock (&d->ioLock);
+	if (__diskOverlayReopenBase (d, O_RDWR) < 0) {
+		pthread_rwlock_unlock (&d->ioLock);
+		free (buf);
+		return -1;
+	}
+	for (unsigned long b = 0, n; b < d->numSectors && ret == 0; b += n) {
+		n = 1;
+		if (!__diskOverlayHas (d, b)) continue;
+		while (b + n < d->numSectors && n < DISK_CONVERTSECTORS &&
+		       __diskOverlayHas (d, b + n))
+			n++;
+		if (__diskRawIO (d, __diskDataPos (d, b), buf, 
+		                 n * DISK_SECTORDATASIZE, 0) < 0 ||
+		    diskWriteSectors (d->base, b, n, buf) < 0)
+			ret = -1;
+	}
+	//A base e' persistida antes de o overlay ser esvaziado: uma queda
+	//entre os dois passos nao perde os setores aplicados
+	if (ret == 0 && diskFlush (d->base) == 0 && 
+	    fdatasync (d->base->fd) == 0)
+		ret = __diskOverlayReset (d);
+	else ret = -1;
+	if (__diskOverlayReopenBase (d, O_RDONLY) < 0) ret = -1;
+	pthread_rwlock_unlock (&d->ioLock);
+	free (buf);
+	return ret;
+}
+
+//Funcao interna que retorna a posicao da camada rapida que contem o setor
+//addr de um disco em camadas, ou -1 se o setor nao estiver presente
+long __diskTierLookup(Disk *d, unsigned long addr) {
+	long slot = d->tierBuckets[addr % d->tierNumSlots];
+	while (slot >= 0 && d->tierSlots[slot].addr != addr + 1)
+		slot = d->tierSlots[slot].next;
+	return slot;
+}
+
+//Funcao interna que associa a posicao livre slot ao setor addr
+void __diskTierLink(Disk *d, long slot, unsigned long addr) {
+	long *bucket = &d->tierBuckets[addr % d->tierNumSlots];
+	d->tierSlots[slot].addr = addr + 1;
+	d->tierSlots[slot].next = *bucket;
+	*bucket = slot;
+}
+
+//Funcao interna que desfaz a associacao entre a posicao slot e seu setor
+void __diskTierUnlink(Disk *d, long slot) {
+	long *link = &d->tierBuckets[(d->tierSlots[slot].addr - 1) 
+	                             % d->tierNumSlots];
+	while (*link != slot) link = &d->tierSlots[*link].next;
+	*link = d->tierSlots[slot].next;
+	d->tierSlots[slot].addr = 0;
+	d->tierSlots[slot].next = -1;
+}
+
+//Funcao interna que grava no arquivo da camada rapida os metadados da
+//posicao slot: setor presente e indicacao de dados sujos. Deve ser chamada
+//com ioLock adquirido. Retorna 0 ou -1
+int __diskTierSaveMeta(Disk *d, long slot) {
+	unsigned char meta[DISK_TIERMETASIZE];
+	memset (meta, 0, sizeof (meta));
+	__diskPutLE (&meta[0], d->tierSlots[slot].addr, 8);
+	meta[8] = d->tierSlots[slot].dirty;
+	return __diskRawIO (d, d->tierMetaBase + slot * DISK_TIERMETASIZE, meta,
+	                    sizeof (meta), 1);
+}
+
+//Funcao interna que retorna o contador de acessos do setor addr
+unsigned char* __diskTierCounter(Disk *d, unsigned long addr) {
+	return &d->tierFreq[addr * 2654435761UL % d->tierFreqSize];
+}
+
+//Funcao interna que contabiliza um acesso ao setor addr, marcando a posicao
+//slot como referenciada se o setor estiver presente (slot >= 0), e retorna
+//seu contador de acessos. Os contadores sao divididos pela metade a cada
+//2*tierFreqSize acessos, de modo que apenas acessos recentes promovam
+//setores. Pode ser chamada com ioLock compartilhado
+unsigned int __diskTierTouch(Disk *d, unsigned long addr, long slot) {
+	unsigned char *f = __diskTierCounter (d, addr);
+	unsigned int count;
+	pthread_mutex_lock (&d->tierLock);
+	if (*f < 255) (*f)++;
+	if (++d->tierAccesses >= 2 * d->tierFreqSize) {
+		for (unsigned long a = 0; a < d->tierFreqSize; a++)
+			d->tierFreq[a] >>= 1;
+		d->tierAccesses = 0;
+	}
+	if (slot >= 0) d->tierSlots[slot].ref = 1;
+	count = *f;
+	pthread_mutex_unlock (&d->tierLock);
+	return count;
+}
+
+//Funcao interna que escolhe, pelo algoritmo CLOCK, uma posicao da camada
+//rapida a ser reutilizada. Um setor sujo substituido e' antes gravado no
+//disco lento, e a posicao e' registrada como livre nos metadados antes de
+//receber outro setor. Deve ser chamada com ioLock adquirido. Retorna a
+//posicao livre ou -1
+long __diskTierEvict(Disk *d) {
+	unsigned char data[DISK_SECTORDATASIZE];
+	for (;;) {
+		long slot = d->tierHand;
+		DiskTierSlot *s = &d->tierSlots[slot];
+		d->tierHand = (d->tierHand + 1) % d->tierNumSlots;
+		if (s->addr && s->ref) {
+			s->ref = 0;
+			continue;
+		}
+		if (!s->addr) return slot;
+		if (s->dirty) {
+			if (__diskRawIO (d, __diskDataPos (d, slot), data,
+			                 DISK_SECTORDATASIZE, 0) < 0 ||
+			    diskWriteSector (d->tierSlow, s->addr - 1, data) < 0)
+				return -1;
+			pthread_mutex_lock (&d->headLock);
+			d->stats.tierWriteBacks++;
+			pthread_mutex_unlock (&d->headLock);
+		}
+		__diskTierUnlink (d, slot);
+		s->dirty = 0;
+		if (__diskTierSaveMeta (d, slot) < 0) return -1;
+		return slot;
+	}
+}
+
+//Funcao interna que grava data na camada rapida como conteudo do setor
+//addr, alocando uma posicao se o setor nao estiver presente. Uma posicao
+//que passa a ser suja e' registrada antes dos dados, e uma recem-alocada
+//apenas depois deles. Deve ser chamada com ioLock adquirido. Retorna 1 se
+//o setor foi promovido a camada rapida, 0 se ja estava presente ou -1
+int __diskTierStore(Disk *d, unsigned long addr, unsigned char *data,
+                    int dirty) {
+	long slot = __diskTierLookup (d, addr);
+	int promoted = (slot < 0);
+	DiskTierSlot *s;
+	if (promoted && (slot = __diskTierEvict (d)) < 0) return -1;
+	s = &d->tierSlots[slot];
+	if (!promoted && dirty && !s->dirty) {
+		s->dirty = 1;
+		if (__diskTierSaveMeta (d, slot) < 0) return -1;
+	}
+	if (__diskRawIO (d, __diskDataPos (d, slot), data,
+	                 DISK_SECTORDATASIZE, 1) < 0)
+		return -1;
+	s->ref = 1;
+	if (promoted) __diskTierLink (d, slot, addr);
+	else if (s->dirty == dirty) return 0;
+	s->dirty = dirty;
+	if (__diskTierSaveMeta (d, slot) < 0) return -1;
+	return promoted;
+}
+
+//Funcao interna que transfere os iovcnt segmentos de um disco em camadas.
+//Leituras de setores presentes na camada rapida nao sofrem posicionamento;
+//as demais recaem sobre o disco lento em trechos contiguos, e os setores
+//lidos com frequencia (DISK_TIERPROMOTE) sao copiados para a camada rapida.
+//Em write-back, escritas vao apenas para a camada rapida; em write-through,
+//vao ao disco lento e atualizam a camada rapida se o setor estiver presente
+//ou for frequente. Apenas os setores transferidos pela camada rapida tem a
+//transferencia cobrada a sua taxa. Retorna 0 ou -1
+int __diskTierRun(Disk *d, DiskIOVec *iov, unsigned int iovcnt, int write) {
+	int through = (d->tierPolicy == DISK_TIER_WRITETHROUGH);
+	unsigned long hits = 0, misses = 0, promotions = 0, fast = 0, writes;
+	int ret = 0, r, promote = 0;
+	//Leituras compartilham ioLock; escritas e substituicoes o exigem
+	//exclusivo
+	if (write) pthread_rwlock_wrlock (&d->ioLock);
+	else pthread_rwlock_rdlock (&d->ioLock);
+	writes = (write ? d->tierWrites++ : d->tierWrites);
+	for (unsigned int a = 0; a < iovcnt && ret == 0; a++) {
+		unsigned long addr = iov[a].addr, count = iov[a].count;
+		if (write && through)
+			ret = diskWriteSectors (d->tierSlow, addr, count,
+			                        iov[a].data);
+		for (unsigned long b = 0, n; b < count && ret == 0; b += n) {
+			unsigned char *data = &iov[a].data[b*DISK_SECTORDATASIZE];
+			long slot = __diskTierLookup (d, addr + b);
+			n = 1;
+			if (write) {
+				if (__diskTierTouch (d, addr + b, -1) 
+				    < DISK_TIERPROMOTE && through && slot < 0)
+					continue;
+				r = __diskTierStore (d, addr + b, data, !through);
+				if (r < 0) ret = -1;
+				else promotions += r;
+				fast++;
+				continue;
+			}
+			if (slot >= 0) {
+				__diskTierTouch (d, addr + b, slot);
+				ret = __diskRawIO (d, __diskDataPos (d, slot), data,
+				                   DISK_SECTORDATASIZE, 0);
+				hits++;
+				continue;
+			}
+			//Trecho de setores ausentes lido de uma so vez
+			while (b + n < count && 
+			       __diskTierLookup (d, addr + b + n) < 0)
+				n++;
+			misses += n;
+			ret = diskReadSectors (d->tierSlow, addr + b, n, data);
+			for (unsigned long c = 0; c < n; c++)
+				if (__diskTierTouch (d, addr + b + c, -1) 
+				    >= DISK_TIERPROMOTE)
+					promote = 1;
+		}
+	}
+	pthread_rwlock_unlock (&d->ioLock);
+	fast += hits;
+	if (promote && ret == 0) {
+		//Promocao dos setores lidos, exclusiva. Uma escrita atendida
+		//desde a leitura pode te-los tornado obsoletos: a promocao e'
+		//abandonada, e os contadores a repetem no proximo acesso
+		pthread_rwlock_wrlock (&d->ioLock);
+		for (unsigned int a = 0; a < iovcnt && ret == 0 && 
+		     d->tierWrites == writes; a++)
+			for (unsigned long b = 0; b < iov[a].count && ret == 0;
+			     b++) {
+				unsigned long addr = iov[a].addr + b;
+				if (*__diskTierCounter (d, addr) 
+				    < DISK_TIERPROMOTE ||
+				    __diskTierLookup (d, addr) >= 0)
+					continue;
+				r = __diskTierStore (d, addr, 
+				         &iov[a].data[b*DISK_SECTORDATASIZE], 0);
+				if (r < 0) ret = -1;
+				else promotions += r;
+				fast++;
+			}
+		pthread_rwlock_unlock (&d->ioLock);
+	}
+	pthread_mutex_lock (&d->headLock);
+	d->stats.tierHits += hits;
+	d->stats.tierMisses += misses;
+	d->stats.tierPromotions += promotions;
+	d->modeledUs += fast * DISK_SECTORDATASIZE * 1000000UL
+	                / d->profile.transferRate;
+	pthread_mutex_unlock (&d->headLock);
+	return ret;
+}
+
+//Funcao interna que cria o arquivo da camada rapida path, vazio, com
+//numSlots posicoes para um disco lento de numSectors setores: cabecalho,
+//metadados e area de dados esparsa. Retorna o descritor do arquivo aberto
+//ou -1
+int __diskCreateTier(char *path, unsigned long numSectors,
+                     unsigned long numSlots) {
+	unsigned char header[DISK_TIERHEADERSIZE];
+	unsigned long metaSize = numSlots * DISK_TIERMETASIZE;
+	int fd = open (path, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) return -1;
+	metaSize = (metaSize + DISK_TIERHEADERSIZE - 1) 
+	           / DISK_TIERHEADERSIZE * DISK_TIERHEADERSIZE;
+	memset (header, 0, sizeof (header));
+	memcpy (header, DISK_TIERMAGIC, DISK_V2MAGICSIZE);
+	__diskPutLE (&header[8], numSectors, 8);
+	__diskPutLE (&header[16], numSlots, 8);
+	__diskPutLE (&header[24], DISK_TIERHEADERSIZE, 8);
+	__diskPutLE (&header[32], DISK_TIERHEADERSIZE + metaSize, 8);
+	if (__diskPIO (fd, 0, header, sizeof (header), 1) < 0 ||
+	    ftruncate (fd, DISK_TIERHEADERSIZE + metaSize 
+	                   + numSlots * DISK_SECTORDATASIZE) < 0) {
+		close (fd);
+		unlink (path);
+		return -1;
+	}
+	return fd;
+}
+
+//Funcao interna que carrega os metadados da camada rapida de um disco em
+//camadas, reconstruindo o hash de setores. Retorna 0 ou -1 se algum
+//registro for invalido
+int __diskTierLoad(Disk *d) {
+	unsigned long size = d->tierNumSlots * DISK_TIERMETASIZE;
+	unsigned char *meta = malloc (size);
+	int ret = 0;
+	if (!meta || __diskPIO (d->fd, d->tierMetaBase, meta, size, 0) < 0) {
+		free (meta);
+		return -1;
+	}
+	for (unsigned long a = 0; a < d->tierNumSlots; a++)
+		d->tierBuckets[a] = -1;
+	for (unsigned long a = 0; a < d->tierNumSlots && ret == 0; a++) {
+		unsigned char *m = &meta[a * DISK_TIERMETASIZE];
+		unsigned long addr = __diskGetLE (m, 8);
+		d->tierSlots[a].addr = 0;
+		d->tierSlots[a].next = -1;
+		d->tierSlots[a].dirty = 0;
+		d->tierSlots[a].ref = 0;
+		if (!addr) continue;
+		if (addr > d->numSectors || __diskTierLookup (d, addr - 1) >= 0)
+			ret = -1;
+		else {
+			__diskTierLink (d, a, addr - 1);
+			d->tierSlots[a].dirty = (m[8] != 0);
+		}
+	}
+	free (meta);
+	return ret;
+}
+
+//Funcao que conecta o disco slowDiskPath precedido de uma camada rapida,
+//implementada pelo arquivo cachePath e criada com cacheSectors setores se
+//nao existir. Um arquivo existente tem seus metadados recuperados
+Disk* diskConnectTiered(int id, char* slowDiskPath, char* cachePath,
+                        unsigned long cacheSectors, int policy) {
+	unsigned char header[DISK_V2MAGICSIZE + 32];
+	Disk *d;
+	if (policy != DISK_TIER_WRITEBACK && policy != DISK_TIER_WRITETHROUGH)
+		return NULL;
+	if ((d = malloc (sizeof (Disk))) == NULL) return NULL;
+	d->fd = -1;
+	d->backend = DISK_BACKEND_PREAD;
+	d->map = NULL;
+	__diskInit (d, id);
+	d->tierPolicy = policy;
+	d->tierSlow = diskConnect (id, slowDiskPath);
+	if (!d->tierSlow) {
+		diskDisconnect (d);
+		return NULL;
+	}
+	//A camada rapida nao possui cabecas nem rotacao: apenas a taxa de
+	//transferencia do perfil e' aplicada
+	d->profile = d->tierSlow->profile;
+	d->profile.seekSettleUs = d->profile.seekSqrtUs = 0;
+	d->profile.seekLinearUs = d->profile.trackSwitchUs = 0;
+	d->profile.rpm = 0;
+	d->profile.transferRate = DISK_TIERTRANSFERRATE;
+	d->format = d->tierSlow->format;
+	d->numSectors = d->tierSlow->numSectors;
+	d->numCylinders = d->tierSlow->numCylinders;
+	d->size = d->tierSlow->size;
+	d->fd = open (cachePath, O_RDWR);
+	if (d->fd < 0 && cacheSectors > 0) 
+		d->fd = __diskCreateTier (cachePath, d->numSectors, cacheSectors);
+	if (d->fd < 0 ||
+	    __diskPIO (d->fd, 0, header, sizeof (header), 0) < 0 ||
+	    memcmp (header, DISK_TIERMAGIC, DISK_V2MAGICSIZE) != 0 ||
+	    __diskGetLE (&header[8], 8) != d->numSectors) {
+		diskDisconnect (d);
+		return NULL;
+	}
+	d->mapSize = lseek (d->fd, 0, SEEK_END);
+	d->tierNumSlots = __diskGetLE (&header[16], 8);
+	d->tierMetaBase = __diskGetLE (&header[24], 8);
+	d->dataBase = __diskGetLE (&header[32], 8);
+	d->sectorStride = DISK_SECTORDATASIZE;
+	d->sectorOffset = 0;
+	d->tierFreqSize = 4 * d->tierNumSlots;
+	if (d->tierNumSlots == 0 || d->tierMetaBase < sizeof (header) ||
+	    d->dataBase < d->tierMetaBase 
+	                  + d->tierNumSlots * DISK_TIERMETASIZE ||
+	    d->mapSize < d->dataBase + d->tierNumSlots * DISK_SECTORDATASIZE ||
+	    (d->tierSlots = malloc (d->tierNumSlots 
+	                            * sizeof (DiskTierSlot))) == NULL ||
+	    (d->tierBuckets = malloc (d->tierNumSlots * sizeof (long))) == NULL ||
+	    (d->tierFreq = calloc (d->tierFreqSize, 1)) == NULL ||
+	    __diskTierLoad (d) < 0) {
+		diskDisconnect (d);
+		return NULL;
+	}
+	return d;
+}
+
+//Funcao que grava no disco lento os setores sujos da camada rapida de um
+//disco em camadas, em lotes ordenados por cilindro
+int diskTierWriteBack (Disk* d) {
+	unsigned long chunk = DISK_CONVERTSECTORS, slot = 0, written = 0;
+	DiskRequest *reqs;
+	unsigned char *buf;
+	long *slots;
+	int ret = 0;
+	if (!d->tierSlow) return -1;
+	reqs = malloc (chunk * sizeof (DiskRequest));
+	buf = malloc (chunk * DISK_SECTORDATASIZE);
+	slots = malloc (chunk * sizeof (long));
+	if (!reqs || !buf || !slots) {
+		free (reqs); free (buf); free (slots);
+		return -1;
+	}
+	pthread_rwlock_wrlock (&d->ioLock);
+	while (slot < d->tierNumSlots && ret == 0) {
+		unsigned int n = 0;
+		//Lotes de ate chunk setores sujos, ordenados por cilindro no
+		//disco lento
+		for (; slot < d->tierNumSlots && n < chunk && ret == 0; slot++) {
+			if (!d->tierSlots[slot].dirty) continue;
+			reqs[n].addr = d->tierSlots[slot].addr - 1;
+			reqs[n].data = &buf[n * DISK_SECTORDATASIZE];
+			reqs[n].write = 1;
+			slots[n] = slot;
+			ret = __diskRawIO (d, __diskDataPos (d, slot), reqs[n].data,
+			                   DISK_SECTORDATASIZE, 0);
+			n++;
+		}
+		if (ret < 0 || diskSubmitBatch (d->tierSlow, reqs, n) < 0) {
+			ret = -1;
+			break;
+		}
+		for (unsigned int a = 0; a < n; a++) {
+			if (reqs[a].result < 0) {
+				ret = -1;
+				continue;
+			}
+			d->tierSlots[slots[a]].dirty = 0;
+			if (__diskTierSaveMeta (d, slots[a]) < 0) ret = -1;
+			written++;
+		}
+	}
+	pthread_rwlock_unlock (&d->ioLock);
+	pthread_mutex_lock (&d->headLock);
+	d->stats.tierWriteBacks += written;
+	pthread_mutex_unlock (&d->headLock);
+	free (reqs);
+	free (buf);
+	free (slots);
+	return ret;
+}
+
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
 //regular indicado por rawDiskPath e com numero total de cilindros indicado
 //por numCylinders. Retorna 0 se o disco fisico for criado com sucesso e -1
 //caso contrario. O disco fisico ja eh criado com formatacao de baixo nivel
 int diskCreateRawDisk (char* rawDiskPath, unsigned long numCylinders) {
+	unsigned long trackSize = DISK_SECTORSPERTRACK * DISK_SECTORTOTALSIZE;
+	unsigned char *tracks;
+	int ret = 0;
 	FILE* fp;
 	if (numCylinders == 0) return -1;
+	//Trilhas ja formatadas sao montadas uma unica vez em memoria e gravadas
+	//em blocos de DISK_CREATETRACKS trilhas por escrita
+	tracks = malloc (DISK_CREATETRACKS * trackSize);
+	if (tracks == NULL) return -1;
+	for (int j = 0; j < DISK_SECTORSPERTRACK * DISK_CREATETRACKS; j++) {
+		unsigned char *sector = &tracks[j * DISK_SECTORTOTALSIZE];
+		memcpy (sector, DISK_SECTORPREAMBLE, DISK_SECTORDATAOFFSET);
+		memset (&sector[DISK_SECTORDATAOFFSET], ' ',
+		        DISK_SECTORDATASIZE);
+		__diskPutTrailer (&sector[DISK_SECTORDATAOFFSET + 
+		                          DISK_SECTORDATASIZE],
+		                  &sector[DISK_SECTORDATAOFFSET]);
+	}
 	fp = fopen (rawDiskPath, "w+");
-	if (fp == NULL) return -1;
-	for (unsigned long i = 0; i < numCylinders; i++) {
-		for (int j = 0; j < DISK_SECTORSPERTRACK; j++) {
-			fwrite(DISK_SECTORPREAMBLE,1,DISK_SECTORDATAOFFSET,fp);
-			for (int k = 0; k < DISK_SECTORDATASIZE; k++)
-				fwrite(" ",1,1,fp);
-			fwrite(DISK_SECTORECC,1,DISK_SECTORDATAOFFSET,fp);
+	if (fp == NULL) {
+		free (tracks);
+		return -1;
+	}
+	//Reserva antecipada do espaco, para que o arquivo seja contiguo
+	posix_fallocate (fileno (fp), 0, numCylinders * trackSize);
+	for (unsigned long i = 0; i < numCylinders && ret == 0;
+	     i += DISK_CREATETRACKS) {
+		unsigned long n = numCylinders - i;
+		if (n > DISK_CREATETRACKS) n = DISK_CREATETRACKS;
+		if (fwrite (tracks, trackSize, n, fp) != n) ret = -1;
+	}
+	if (fclose (fp) != 0) ret = -1;
+	free (tracks);
+	return ret;
+}
+
+//Funcao interna que retorna a distancia, em cilindros, entre dois cilindros
+unsigned long __diskCylDistance(unsigned long from, unsigned long to) {
+	return (from < to ? to - from : from - to);
+}
+
+//Funcao interna de comparacao de requisicoes pelo endereco LBA. Como o
+//cilindro cresce com o endereco, a ordem resultante e' a ordem da varredura
+int __diskRequestCompare(const void *a, const void *b) {
+	const DiskRequest *ra = *(DiskRequest* const *) a;
+	const DiskRequest *rb = *(DiskRequest* const *) b;
+	if (ra->addr < rb->addr) return -1;
+	return (ra->addr > rb->addr ? 1 : 0);
+}
+
+//Funcao que atende um lote de numReqs requisicoes de setores (reqs) em ordem
+//C-LOOK: as cabecas varrem os cilindros em sentido crescente a partir da
+//posicao atual e retornam ao menor cilindro pendente ao fim da varredura.
+//Nenhuma requisicao e' preterida por mais de DISK_SCHEDDEADLINE atendimentos
+//alem de sua posicao no lote. O resultado de cada requisicao e' escrito em
+//seu campo result. Retorna o numero de requisicoes atendidas sem erros ou -1
+//caso os parametros sejam invalidos
+int diskSubmitBatch (Disk* d, DiskRequest* reqs, unsigned int numReqs) {
+	DiskRequest **order;
+	unsigned int *sortedPos;
+	unsigned char *done;
+	unsigned long head, cyl, fifoCyl = 0, schedCyl = 0;
+	unsigned int pos = 0, oldest = 0;
+	int served = 0;
+
+	if (!d || (!reqs && numReqs)) return -1;
+	if (!numReqs) return 0;
+
+	order = malloc (numReqs * sizeof (DiskRequest*));
+	sortedPos = malloc (numReqs * sizeof (unsigned int));
+	done = calloc (numReqs, 1);
+	if (!order || !sortedPos || !done) {
+		free (order); free (sortedPos); free (done);
+		return -1;
+	}
+
+	//Custo de referencia: atendimento na ordem de submissao
+	head = diskGetCurrentCylinder (d);
+	for (unsigned int a = 0; a < numReqs; a++) {
+		order[a] = &reqs[a];
+		if (diskAddrToCylinder (d, reqs[a].addr, &cyl) < 0) continue;
+		fifoCyl += __diskCylDistance (head, cyl);
+		head = cyl;
+	}
+
+	qsort (order, numReqs, sizeof (DiskRequest*), __diskRequestCompare);
+	for (unsigned int a = 0; a < numReqs; a++)
+		sortedPos[order[a] - reqs] = a;
+
+	//A varredura comeca na primeira requisicao a partir do cilindro atual
+	head = diskGetCurrentCylinder (d);
+	while (pos < numReqs && 
+	       order[pos]->addr / d->profile.sectorsPerTrack < head)
+		pos++;
+	if (pos == numReqs) pos = 0;
+
+	for (unsigned int s = 0; s < numReqs; s++) {
+		DiskRequest *r;
+		while (done[oldest]) oldest++;
+		if (s >= oldest + DISK_SCHEDDEADLINE) {
+			//Prazo esgotado: atende a mais antiga e segue dali
+			r = &reqs[oldest];
+			pos = sortedPos[oldest];
+		}
+		else {
+			while (done[order[pos] - reqs]) 
+				pos = (pos + 1) % numReqs;
+			r = order[pos];
+		}
+		done[r - reqs] = 1;
+		pos = (pos + 1) % numReqs;
+
+		if (diskAddrToCylinder (d, r->addr, &cyl) == 0) {
+			schedCyl += __diskCylDistance (head, cyl);
+			head = cyl;
 		}
-//		fflush(stdout);
+		if (r->write) r->result = diskWriteSector (d, r->addr, r->data);
+		else r->result = diskReadSector (d, r->addr, r->data);
+		if (r->result == 0) served++;
 	}
-	fclose(fp);
-	return 0;
+
+	pthread_mutex_lock (&d->headLock);
+	d->schedFifoCyl += fifoCyl;
+	d->schedCyl += schedCyl;
+	pthread_mutex_unlock (&d->headLock);
+	free (order);
+	free (sortedPos);
+	free (done);
+	return served;
+}
+
+//Funcao que retorna o numero de cilindros de deslocamento que o escalonador
+//economizou, desde a conexao do disco, em relacao ao atendimento dos lotes
+//na ordem de submissao
+unsigned long diskGetSeeksSaved (Disk* d) {
+	unsigned long saved = 0;
+	pthread_mutex_lock (&d->headLock);
+	if (d->schedFifoCyl > d->schedCyl) 
+		saved = d->schedFifoCyl - d->schedCyl;
+	pthread_mutex_unlock (&d->headLock);
+	return saved;
+}
+
+//Funcao interna executada pela thread de E/S assincrona. Cada rodada retira
+//todas as submissoes pendentes e as atende como um lote do escalonador
+//(diskSubmitBatch), publicando em seguida as conclusoes
+void* __diskAioWorker(void *arg) {
+	Disk *d = arg;
+	pthread_mutex_lock (&d->aioLock);
+	while (1) {
+		DiskRequest **sq, *batch;
+		void **userData;
+		unsigned int n;
+		while (!d->aioSqCount && !d->aioStop)
+			pthread_cond_wait (&d->aioSubmitted, &d->aioLock);
+		if (!d->aioSqCount) break;
+
+		sq = d->aioSq;
+		userData = d->aioSqUserData;
+		n = d->aioSqCount;
+		d->aioSq = NULL;
+		d->aioSqUserData = NULL;
+		d->aioSqCount = d->aioSqCap = 0;
+		d->aioInFlight = n;
+		pthread_mutex_unlock (&d->aioLock);
+
+		batch = malloc (n * sizeof (DiskRequest));
+		if (batch) {
+			for (unsigned int a = 0; a < n; a++) batch[a] = *sq[a];
+			diskSubmitBatch (d, batch, n);
+			for (unsigned int a = 0; a < n; a++) 
+				sq[a]->result = batch[a].result;
+			free (batch);
+		}
+		else for (unsigned int a = 0; a < n; a++) sq[a]->result = -1;
+
+		//diskAioSubmit reserva na fila de conclusoes o espaco de cada
+		//requisicao submetida, portanto nenhuma conclusao e' perdida
+		pthread_mutex_lock (&d->aioLock);
+		for (unsigned int a = 0; a < n; a++) {
+			d->aioCq[d->aioCqCount].req = sq[a];
+			d->aioCq[d->aioCqCount].userData = userData[a];
+			d->aioCq[d->aioCqCount].result = sq[a]->result;
+			d->aioCqCount++;
+		}
+		d->aioInFlight = 0;
+		free (sq);
+		free (userData);
+		pthread_cond_broadcast (&d->aioCompleted);
+	}
+	pthread_mutex_unlock (&d->aioLock);
+	return NULL;
+}
+
+//Funcao interna que encerra a thread de E/S assincrona, apos o atendimento
+//das submissoes pendentes, e libera as filas
+void __diskAioShutdown(Disk *d) {
+	pthread_mutex_lock (&d->aioLock);
+	d->aioStop = 1;
+	pthread_cond_signal (&d->aioSubmitted);
+	pthread_mutex_unlock (&d->aioLock);
+	if (d->aioRunning) pthread_join (d->aioThread, NULL);
+	d->aioRunning = 0;
+	free (d->aioSq);
+	free (d->aioSqUserData);
+	free (d->aioCq);
+	pthread_mutex_destroy (&d->aioLock);
+	pthread_cond_destroy (&d->aioSubmitted);
+	pthread_cond_destroy (&d->aioCompleted);
+}
+
+//Funcao que submete uma requisicao (req) para atendimento assincrono pela
+//thread de E/S do disco, iniciada na primeira submissao, reservando espaco
+//para sua conclusao. A requisicao e o seu buffer devem permanecer validos
+//ate a coleta da conclusao, que carrega userData. Retorna 0 se a requisicao
+//foi enfileirada ou -1 caso contrario
+int diskAioSubmit (Disk* d, DiskRequest* req, void* userData) {
+	int ret = 0;
+	if (!d || !req) return -1;
+	pthread_mutex_lock (&d->aioLock);
+	if (!d->aioRunning) {
+		if (pthread_create (&d->aioThread, NULL, __diskAioWorker, d))
+			ret = -1;
+		else d->aioRunning = 1;
+	}
+	if (ret == 0 && d->aioSqCount == d->aioSqCap) {
+		unsigned int cap = (d->aioSqCap ? 2 * d->aioSqCap : 16);
+		DiskRequest **sq = realloc (d->aioSq, 
+		                            cap * sizeof (DiskRequest*));
+		void **ud = (sq ? realloc (d->aioSqUserData,
+		                           cap * sizeof (void*)) : NULL);
+		if (sq) d->aioSq = sq;
+		if (ud) {
+			d->aioSqUserData = ud;
+			d->aioSqCap = cap;
+		}
+		else ret = -1;
+	}
+	if (ret == 0 &&
+	    d->aioCqCount + d->aioInFlight + d->aioSqCount == d->aioCqCap) {
+		unsigned int cap = (d->aioCqCap ? 2 * d->aioCqCap : 16);
+		DiskCompletion *cq = realloc (d->aioCq,
+		                              cap * sizeof (DiskCompletion));
+		if (cq) {
+			d->aioCq = cq;
+			d->aioCqCap = cap;
+		}
+		else ret = -1;
+	}
+	if (ret == 0) {
+		d->aioSq[d->aioSqCount] = req;
+		d->aioSqUserData[d->aioSqCount] = userData;
+		d->aioSqCount++;
+		pthread_cond_signal (&d->aioSubmitted);
+	}
+	pthread_mutex_unlock (&d->aioLock);
+	return ret;
+}
+
+//Funcao interna que move ate maxComps conclusoes da fila para comps.
+//Deve ser chamada com aioLock adquirido
+unsigned int __diskAioReap(Disk *d, DiskCompletion *comps, 
+                           unsigned int maxComps) {
+	unsigned int n = (d->aioCqCount < maxComps ? d->aioCqCount : maxComps);
+	memcpy (comps, d->aioCq, n * sizeof (DiskCompletion));
+	memmove (d->aioCq, &d->aioCq[n], 
+	         (d->aioCqCount - n) * sizeof (DiskCompletion));
+	d->aioCqCount -= n;
+	return n;
+}
+
+//Funcao que coleta, sem bloquear, ate maxComps conclusoes de requisicoes
+//assincronas, copiando-as para comps. Retorna o numero de conclusoes
+//coletadas ou -1 caso os parametros sejam invalidos
+int diskAioPoll (Disk* d, DiskCompletion* comps, unsigned int maxComps) {
+	unsigned int n;
+	if (!d || (!comps && maxComps)) return -1;
+	pthread_mutex_lock (&d->aioLock);
+	n = __diskAioReap (d, comps, maxComps);
+	pthread_mutex_unlock (&d->aioLock);
+	return n;
+}
+
+//Funcao que aguarda ate que ao menos minComps conclusoes estejam disponiveis,
+//ou que nao restem requisicoes pendentes, e coleta ate maxComps conclusoes
+//em comps. Retorna o numero de conclusoes coletadas ou -1 caso os parametros
+//sejam invalidos
+int diskAioWait (Disk* d, DiskCompletion* comps, unsigned int minComps,
+                 unsigned int maxComps) {
+	unsigned int n;
+	if (!d || !comps || minComps > maxComps) return -1;
+	pthread_mutex_lock (&d->aioLock);
+	while (d->aioCqCount < minComps && 
+	       (d->aioSqCount || d->aioInFlight))
+		pthread_cond_wait (&d->aioCompleted, &d->aioLock);
+	n = __diskAioReap (d, comps, maxComps);
+	pthread_mutex_unlock (&d->aioLock);
+	return n;
 }
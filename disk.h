@@ -13,39 +13,243 @@
 #ifndef DISK_H
 #define DISK_H
 
-//Escolha pela funcao de sleep suportada pelo sistema operacional hospedeiro
-//Windows: Sleep()
-//Unix: nanosleep()
-#ifdef _WIN32
-#   include <windows.h>
-#   define SLEEP(msecs) Sleep(msecs)
-#else
-#   include <time.h>
-#   define SLEEP(msecs) do {            \
+//Funcao de sleep do sistema operacional hospedeiro (Unix: nanosleep()). O
+//disco depende de pread/pwrite, mmap e pthreads, portanto apenas sistemas
+//POSIX sao suportados
+#include <time.h>
+#define SLEEP(msecs) do {               \
         struct timespec ts;             \
         ts.tv_sec = msecs/1000;         \
         ts.tv_nsec = msecs%1000*1000000L;\
         nanosleep(&ts, NULL);           \
         } while (0)
-#endif
 
 //Tamanho padrao do setor de qualquer disco, em bytes
 #define DISK_SECTORDATASIZE 512
 
-//Tipo de dados para a representacao de discos fisicos
+//Backends de acesso ao arquivo que implementa um disco fisico
+#define DISK_BACKEND_PREAD 0	//pread/pwrite posicionais sobre o arquivo
+#define DISK_BACKEND_MMAP 1	//Arquivo inteiro mapeado em memoria (memcpy)
+#define DISK_BACKEND_DIRECT 2	//O_DIRECT com buffers alinhados, sem cache
+
+//Formatos de imagem de disco, identificados automaticamente na conexao
+#define DISK_FORMAT_V1 1	//Setores enquadrados por preambulo e ECC (CRC)
+#define DISK_FORMAT_V2 2	//Cabecalho de 4 KiB, tabela de CRC e setores
+
+//Politicas de escrita de discos em camadas (diskConnectTiered)
+#define DISK_TIER_WRITEBACK 0	//Escritas na camada rapida, copiadas depois
+#define DISK_TIER_WRITETHROUGH 1 //Escritas no disco lento e na camada rapida
+
+//Tipo de dados para a representacao de discos fisicos. Um Disk pode ser
+//acessado simultaneamente por varias threads: leituras sao transferidas em
+//paralelo, escritas sao exclusivas e as cabecas se deslocam uma requisicao
+//por vez
 typedef struct disk Disk;
 
+//Tipo de dados para a representacao do perfil de desempenho de um disco:
+//geometria e parametros do modelo de latencia. O perfil e' carregado na
+//conexao a partir do arquivo <imagem>.prof, se existir (diskLoadProfile)
+typedef struct disk_profile {
+	unsigned long sectorsPerTrack;	//Setores por trilha (por cilindro)
+	unsigned long seekSettleUs;	//Custo fixo de todo posicionamento, em us
+	unsigned long seekSqrtUs;	//Custo por raiz da distancia (aceleracao)
+	unsigned long seekLinearUs;	//Custo por cilindro percorrido, em us
+	unsigned long trackSwitchUs;	//Custo para cilindro vizinho (0: curva)
+	unsigned long rpm;		//Rotacoes por minuto (0: sem rotacao)
+	unsigned long transferRate;	//Taxa de transferencia, em bytes/s
+} DiskProfile;
+
+//Tipo de dados para a representacao dos contadores de desempenho de um disco
+typedef struct disk_stats {
+	unsigned long readCalls;	//Chamadas de leitura atendidas
+	unsigned long writeCalls;	//Chamadas de escrita atendidas
+	unsigned long sectorsRead;	//Setores lidos
+	unsigned long sectorsWritten;	//Setores escritos
+	unsigned long bytesRead;	//Bytes de dados lidos
+	unsigned long bytesWritten;	//Bytes de dados escritos
+	unsigned long seeks;		//Posicionamentos com troca de cilindro
+	unsigned long cylindersTraversed; //Cilindros percorridos pelas cabecas
+	unsigned long seekDelayUs;	//Atraso total de posicionamento, em us
+	unsigned long totalLatencyUs;	//Soma das latencias das chamadas, em us
+	unsigned long maxLatencyUs;	//Maior latencia de uma chamada, em us
+	unsigned long checksumErrors;	//Setores lidos com CRC divergente
+	unsigned long trackBufHits;	//Setores lidos do buffer de trilha
+	unsigned long trackBufMisses;	//Trilhas carregadas no buffer de trilha
+	unsigned long tierHits;		//Setores lidos da camada rapida
+	unsigned long tierMisses;	//Setores lidos do disco lento
+	unsigned long tierPromotions;	//Setores copiados para a camada rapida
+	unsigned long tierWriteBacks;	//Setores sujos gravados no disco lento
+} DiskStats;
+
+//Tipo de dados para a representacao de uma requisicao de acesso a um setor,
+//submetida em lote ao escalonador do disco por meio de diskSubmitBatch
+typedef struct disk_request {
+	unsigned long addr;	//Endereco LBA do setor
+	unsigned char *data;	//Buffer de origem (escrita) ou destino (leitura)
+	int write;		//0 para leitura, 1 para escrita
+	int result;		//Preenchido com 0 se atendida sem erros ou -1
+} DiskRequest;
+
+//Tipo de dados para a representacao da conclusao de uma requisicao submetida
+//para atendimento assincrono por meio de diskAioSubmit
+typedef struct disk_completion {
+	DiskRequest *req;	//Requisicao concluida
+	void *userData;		//Dado do usuario informado na submissao
+	int result;		//0 se atendida sem erros ou -1
+} DiskCompletion;
+
+//Tipo de dados para a representacao de um segmento de uma transferencia
+//vetorizada (scatter/gather) de setores consecutivos
+typedef struct disk_iovec {
+	unsigned long addr;	//Endereco LBA do primeiro setor do segmento
+	unsigned long count;	//Numero de setores do segmento
+	unsigned char *data;	//Buffer com count*DISK_SECTORDATASIZE bytes
+} DiskIOVec;
+
+//Funcao que preenche *p com o perfil padrao de um disco: 64 setores por
+//trilha, 10 ms por cilindro percorrido, sem latencia rotacional
+void diskDefaultProfile (DiskProfile* p);
+
+//Funcao que carrega em *p o perfil de desempenho descrito no arquivo texto
+//profilePath, com uma linha chave=valor por parametro (mesmos nomes dos
+//campos de DiskProfile) e comentarios iniciados por '#'. Parametros ausentes
+//mantem os valores padrao. Retorna 0 se bem sucedida ou -1 caso o arquivo
+//nao exista ou seja invalido
+int diskLoadProfile (char* profilePath, DiskProfile* p);
+
 //Funcao que conecta um disco fisico ao sistema operacional.
 //Um disco fisico eh implementado por meio de um arquivo regular, 
 //cujo caminho eh dado por rawDiskPath.
 //O parametro id eh um identificador unico para o disco, controlado
 //pelo sistema operacional. Se o disco existir, retorna um ponteiro para Disk.
-//Caso contrario, retorna NULL
+//Caso contrario, retorna NULL. O formato da imagem (v1 ou v2) e' detectado
+//automaticamente. Se existir o arquivo rawDiskPath.prof, a
+//geometria e o modelo de latencia do disco sao lidos dele (diskLoadProfile)
 Disk* diskConnect(int id, char* diskFilePath);
 
+//Funcao que conecta um disco fisico ao sistema operacional, como em
+//diskConnect (inclusive quanto ao perfil), escolhendo o backend de acesso
+//ao arquivo (DISK_BACKEND_*). Se o sistema de arquivos hospedeiro recusar
+//O_DIRECT, DISK_BACKEND_DIRECT recai em DISK_BACKEND_PREAD (veja
+//diskGetBackend). Retorna NULL se o disco nao existir ou o backend nao for
+//suportado
+Disk* diskConnectEx(int id, char* diskFilePath, int backend);
+
+//Funcao que conecta ao sistema operacional um disco virtual em faixas
+//(RAID-0) formado pelos numMembers discos fisicos cujos caminhos sao dados
+//por rawDiskPaths. Setores consecutivos sao distribuidos em faixas de
+//stripeSectors setores, alternando entre os membros. Cada membro mantem suas
+//proprias cabecas, e transferencias de varios setores ocorrem em paralelo
+//nos membros. A capacidade e' limitada pelo menor membro. Retorna ponteiro
+//para Disk ou NULL se algum membro nao puder ser conectado ou for menor que
+//uma faixa
+Disk* diskConnectStriped(int id, char** rawDiskPaths, unsigned int numMembers,
+                         unsigned long stripeSectors);
+
+//Funcao que conecta ao sistema operacional o disco da imagem base
+//baseDiskPath acrescida do arquivo de overlay overlayPath, criado vazio se
+//nao existir. Escritas sao gravadas apenas no overlay, setor a setor, e
+//leituras de setores nunca escritos recaem sobre a base, que nao e'
+//modificada. O overlay e' um arquivo esparso: ocupa apenas os setores
+//escritos. Retorna ponteiro para Disk ou NULL se a base nao puder ser
+//conectada ou o overlay nao corresponder a ela
+Disk* diskConnectOverlay(int id, char* baseDiskPath, char* overlayPath);
+
+//Funcao que descarta todas as escritas registradas no overlay de um disco,
+//que volta a refletir a imagem base. Retorna 0 se bem sucedida ou -1 caso
+//contrario (inclusive se o disco nao possuir overlay)
+int diskOverlayDiscard (Disk* d);
+
+//Funcao que aplica a imagem base todos os setores registrados no overlay de
+//um disco e em seguida o esvazia. Retorna 0 se bem sucedida ou -1 caso
+//contrario (inclusive se o disco nao possuir overlay)
+int diskOverlayMerge (Disk* d);
+
+//Funcao que conecta ao sistema operacional o disco slowDiskPath (conectado
+//como em diskConnect) precedido de uma camada rapida, sem posicionamento nem
+//rotacao, implementada pelo arquivo cachePath. Se cachePath nao existir, e'
+//criado com cacheSectors setores; caso contrario, cacheSectors e' ignorado e
+//o conteudo da camada, inclusive setores sujos, e' recuperado de seus
+//metadados. Setores lidos com frequencia sao promovidos a camada rapida,
+//substituidos pelo algoritmo CLOCK. Em DISK_TIER_WRITEBACK, escritas sao
+//gravadas apenas na camada rapida e copiadas para o disco lento na
+//substituicao ou em diskTierWriteBack; em DISK_TIER_WRITETHROUGH, vao
+//diretamente ao disco lento. Retorna ponteiro para Disk ou NULL se o disco
+//lento nao puder ser conectado ou a camada nao corresponder a ele
+Disk* diskConnectTiered(int id, char* slowDiskPath, char* cachePath,
+                        unsigned long cacheSectors, int policy);
+
+//Funcao que grava no disco lento todos os setores sujos da camada rapida de
+//um disco em camadas, em lotes ordenados por cilindro (diskSubmitBatch). A
+//camada mantem os setores, agora limpos. Retorna 0 se bem sucedida ou -1
+//caso contrario (inclusive se o disco nao possuir camadas)
+int diskTierWriteBack (Disk* d);
+
 //Funcao que disconecta um disco fisico do sistema operacional
 int diskDisconnect(Disk* d);
 
+//Funcao que converte a imagem de disco srcPath para o formato format
+//(DISK_FORMAT_*), gravando o resultado em dstPath, que e' sobrescrito. O
+//conteudo de todos os setores e a geometria sao preservados; imagens v1 sao
+//geradas com 64 setores por trilha. A copia nao sofre os atrasos do modelo
+//de disco. Retorna 0 se bem sucedida ou -1 caso contrario
+int diskConvertImage (char* srcPath, char* dstPath, int format);
+
+//Funcao que retorna o formato da imagem de um disco (DISK_FORMAT_*)
+int diskGetFormat (Disk* d);
+
+//Funcao que retorna o backend efetivamente em uso por um disco
+//(DISK_BACKEND_*)
+int diskGetBackend (Disk* d);
+
+//Funcao que ativa (enabled diferente de 0) ou desativa a conferencia do
+//CRC32C dos setores nas leituras de um disco (ativa na conexao). Setores
+//corrompidos fazem a leitura retornar -1 e sao contados em checksumErrors
+void diskSetVerify (Disk* d, int enabled);
+
+//Funcao que ativa (enabled diferente de 0) ou desativa o buffer de trilha
+//de um disco, desativado na conexao. Com o buffer, uma leitura de setor
+//ausente carrega a trilha inteira que o contem; leituras seguintes da mesma
+//trilha sao atendidas sem posicionamento nem acesso ao arquivo. Escritas
+//vao sempre a midia e atualizam a trilha presente no buffer. Nao deve ser
+//chamada com transferencias em andamento. Retorna 0 se bem sucedida ou -1
+//caso contrario
+int diskSetTrackBuffer (Disk* d, int enabled);
+
+//Funcao que confere o CRC32C de todos os setores de um disco, percorrendo
+//a imagem sem os atrasos do modelo de disco. Setores de imagens antigas,
+//ainda sem CRC, sao aceitos. Retorna o numero de setores corrompidos ou -1
+//em caso de erro de leitura. Se houver setores corrompidos e firstBad nao
+//for NULL, *firstBad recebe o menor endereco entre eles
+long diskVerify (Disk* d, unsigned long* firstBad);
+
+//Funcao que persiste no arquivo do disco os dados ainda mantidos em memoria
+//pelo backend (paginas do mapeamento). Retorna 0 se bem sucedida ou -1 caso
+//contrario
+int diskFlush(Disk* d);
+
+//Funcao que copia para *stats os contadores de desempenho do disco,
+//acumulados desde a conexao ou a ultima chamada a diskResetStats
+void diskGetStats (Disk* d, DiskStats* stats);
+
+//Funcao que zera os contadores de desempenho de um disco
+void diskResetStats (Disk* d);
+
+//Funcao que copia para *p o perfil de desempenho em uso por um disco
+void diskGetProfile (Disk* d, DiskProfile* p);
+
+//Funcao que ativa (enabled diferente de 0) ou desativa o modo de tempo
+//virtual de um disco. Nesse modo, os custos de posicionamento e de
+//transferencia sao apenas acumulados no tempo modelado, sem atrasos reais
+void diskSetVirtualTime (Disk* d, int enabled);
+
+//Funcao que retorna o tempo de disco modelado, em microssegundos, desde a
+//conexao: soma dos custos de posicionamento e de transferencia, em qualquer
+//modo. Em discos em faixas, os membros operam em paralelo e o tempo e' o do
+//membro mais ocupado. Em discos em camadas, somam-se os tempos da camada
+//rapida e do disco lento
+unsigned long diskGetModeledTime (Disk* d);
+
 //Funcao que retorna o identificador de um disco fisico, conforme atribuido
 //pelo sistema operacional no momento da conexao
 int diskGetId (Disk* d);
@@ -79,6 +283,65 @@ int diskReadSector (Disk* d, unsigned long addr, unsigned char* data);
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long int addr, unsigned char* data);
 
+//Funcao para realizar a leitura de count setores consecutivos a partir do
+//endereco LBA addr, com um unico posicionamento das cabecas. Os dados sao
+//transferidos para *data, que deve comportar count*DISK_SECTORDATASIZE bytes.
+//Retorna 0 se a leitura ocorreu sem erros e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned long count,
+                     unsigned char* data);
+
+//Funcao para realizar a escrita de count setores consecutivos a partir do
+//endereco LBA addr, com um unico posicionamento das cabecas. Os dados sao
+//transferidos a partir de *data. Retorna 0 se a escrita ocorreu sem erros e
+//-1 caso contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned long count,
+                      unsigned char* data);
+
+//Funcao para realizar a leitura vetorizada (scatter) dos iovcnt segmentos
+//descritos em iov. Segmentos cujos setores sao contiguos aos do segmento
+//anterior sao atendidos em uma unica transferencia, com um unico
+//posicionamento das cabecas. Retorna 0 se a leitura ocorreu sem erros e -1
+//caso contrario
+int diskReadSectorsV (Disk* d, DiskIOVec* iov, unsigned int iovcnt);
+
+//Funcao para realizar a escrita vetorizada (gather) dos iovcnt segmentos
+//descritos em iov, agrupando segmentos contiguos como em diskReadSectorsV.
+//Retorna 0 se a escrita ocorreu sem erros e -1 caso contrario
+int diskWriteSectorsV (Disk* d, DiskIOVec* iov, unsigned int iovcnt);
+
+//Funcao que atende um lote de numReqs requisicoes de setores (reqs) em ordem
+//C-LOOK: as cabecas varrem os cilindros em sentido crescente a partir da
+//posicao atual e retornam ao menor cilindro pendente ao fim da varredura.
+//Nenhuma requisicao e' preterida por mais de DISK_SCHEDDEADLINE atendimentos
+//alem de sua posicao no lote. O resultado de cada requisicao e' escrito em
+//seu campo result. Retorna o numero de requisicoes atendidas sem erros ou -1
+//caso os parametros sejam invalidos
+int diskSubmitBatch (Disk* d, DiskRequest* reqs, unsigned int numReqs);
+
+//Funcao que retorna o numero de cilindros de deslocamento que o escalonador
+//economizou, desde a conexao do disco, em relacao ao atendimento dos lotes
+//na ordem de submissao
+unsigned long diskGetSeeksSaved (Disk* d);
+
+//Funcao que submete uma requisicao (req) para atendimento assincrono pela
+//thread de E/S do disco, iniciada na primeira submissao. A requisicao e o
+//seu buffer devem permanecer validos ate a coleta da conclusao, que carrega
+//userData. Requisicoes pendentes sao atendidas em lotes, em ordem C-LOOK.
+//Retorna 0 se a requisicao foi enfileirada ou -1 caso contrario
+int diskAioSubmit (Disk* d, DiskRequest* req, void* userData);
+
+//Funcao que coleta, sem bloquear, ate maxComps conclusoes de requisicoes
+//assincronas, copiando-as para comps. Retorna o numero de conclusoes
+//coletadas ou -1 caso os parametros sejam invalidos
+int diskAioPoll (Disk* d, DiskCompletion* comps, unsigned int maxComps);
+
+//Funcao que aguarda ate que ao menos minComps conclusoes estejam disponiveis,
+//ou que nao restem requisicoes pendentes, e coleta ate maxComps conclusoes
+//em comps. Retorna o numero de conclusoes coletadas ou -1 caso os parametros
+//sejam invalidos
+int diskAioWait (Disk* d, DiskCompletion* comps, unsigned int minComps,
+                 unsigned int maxComps);
+
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
 //regular indicado por rawDiskPath e com numero total de cilindros indicado
 //por numCylinders. Retorna 0 se o disco fisico for criado com sucesso e -1
@@ -0,0 +1,41 @@
+/*
+*  dskconv.c - Conversor de imagens de disco entre os formatos v1 e v2
+*
+*  Projeto: Trabalho Pratico II - Sistemas Operacionais
+*  Organizacao: Universidade Federal de Juiz de Fora
+*  Departamento: Dep. Ciencia da Computacao
+*
+*  Uso: dskconv <v1|v2> <imagem de origem> <imagem de destino>
+*
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "disk.h"
+
+int main (int argc, char* argv[]) {
+	int format;
+
+	if (argc != 4) {
+		fprintf (stderr, "Uso: %s <v1|v2> <origem.dsk> <destino.dsk>\n",
+		         argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!strcmp (argv[1], "v1")) format = DISK_FORMAT_V1;
+	else if (!strcmp (argv[1], "v2")) format = DISK_FORMAT_V2;
+	else {
+		fprintf (stderr, "!! dskconv: Formato desconhecido: %s\n",
+		         argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	if (diskConvertImage (argv[2], argv[3], format) < 0) {
+		fprintf (stderr, "!! dskconv: FAILED. Cannot convert %s to %s\n",
+		         argv[2], argv[3]);
+		return EXIT_FAILURE;
+	}
+	printf ("-- Image %s successfully converted to %s (%s)\n",
+	        argv[2], argv[3], argv[1]);
+	return EXIT_SUCCESS;
+}
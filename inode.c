@@ -11,7 +11,10 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "inode.h"
+#include "bcache.h"
 #include "util.h"
 
 #define INODE_SIZE 16		//Tamanho do i-node em numero de unsigned ints
@@ -25,7 +28,27 @@
 #define INODE_ITEM_PERMISSION (INODE_SIZE - 4)	//Item 12: Permissao
 #define INODE_ITEM_REFCOUNT (INODE_SIZE - 3)	//Item 13: Contador referencia
 
+//Layout por extents: o bit INODE_FLAG_EXTENTS do tipo de arquivo identifica
+//o i-node. Os itens 0 a 5 guardam 2 extents, os itens 6 e 7 o total de
+//blocos e de extents do arquivo e cada extensao guarda 4 extents (itens 0 a
+//11). Cada extent ocupa 3 itens: bloco fisico inicial, bloco logico inicial
+//e comprimento (o bloco fisico vem primeiro e nunca e' 0)
+#define INODE_FLAG_EXTENTS 0x80000000u	//Bit do tipo: i-node com extents
+#define INODE_EXTENTITEMS 3		//Itens por extent
+#define NUMEXTENTS_PERINODE 2		//Extents no primeiro i-node da cadeia
+#define NUMEXTENTS_PEREXT 4		//Extents por i-node de extensao
+#define INODE_ITEM_NUMBLOCKS 6		//Item 6: Total de blocos (extents)
+#define INODE_ITEM_NUMEXTENTS 7		//Item 7: Total de extents
+
 #define INODE_BEGINSECTOR 2
+#define INODE_PERSECTOR \
+	(DISK_SECTORDATASIZE / (INODE_SIZE * sizeof (unsigned int)))
+#define INODE_SCANSECTORS 16	//Setores lidos por chamada na busca por livres
+#define INODE_CACHESIZE 256	//I-nodes mantidos decodificados em memoria
+#define INODE_MAPSECTOR 1	//Setor do descritor do mapa de i-nodes livres
+#define INODE_MAPMAGIC "INODEMAP"	//Identificacao do descritor (8 bytes)
+#define INODE_MAPBITS (DISK_SECTORDATASIZE * 8)	//I-nodes por setor do mapa
+#define INODE_MAPWORDBITS 64	//Bits por palavra do espelho em memoria
 
 //Tipo para representacao de i-nodes
 struct inode {
@@ -35,26 +58,601 @@ struct inode {
 	Disk *d; 		//Disco ao qual pertence o i-node
 };
 
-//Funcao interna que retorna a ultima extensao de um i-node. Retorna NULL
-//se nao houver extensoes do i-node fornecido.
-Inode* __inodeGetLastExtension (Inode *i) {
+//Tipo para representacao de um extent: length blocos contiguos do arquivo,
+//a partir do bloco logico logical, gravados a partir do bloco physical
+typedef struct inode_extent {
+	unsigned int logical;	//Primeiro bloco do arquivo
+	unsigned int physical;	//Endereco do primeiro bloco no disco
+	unsigned int length;	//Numero de blocos
+} InodeExtent;
+
+//Tipo para representacao de uma entrada da cache de i-nodes
+typedef struct inode_cache_entry {
+	Inode inode;		//I-node decodificado
+	InodeExtent *extents;	//Extents de toda a cadeia, ordenados pelo bloco
+				//logico (i-nodes com extents; NULL: nao lidos)
+	unsigned int tail;	//Ultimo i-node da cadeia (0: desconhecido)
+	unsigned int tailSlot;	//Limite inferior do primeiro item livre em tail
+	Disk *d;		//Disco do i-node (NULL: entrada livre)
+	unsigned int number;	//Numero do i-node no disco
+	int refs;		//Referencias em uso (inodeGet)
+	int dirty;		//Modificado e ainda nao gravado em seu setor
+	unsigned long dirtySince; //Instante em que ficou sujo, em us
+	int ref;		//Bit de referencia do algoritmo CLOCK
+	int hashNext;		//Proxima entrada do mesmo balde (-1: fim)
+} InodeCacheEntry;
+
+InodeCacheEntry inodeCache[INODE_CACHESIZE];	//Entradas da cache
+int inodeCacheBuckets[INODE_CACHESIZE];	//Tabela hash (disco, numero)
+int inodeCacheReady = 0;		//Baldes ja iniciados
+int inodeFlushHookReady = 0;		//Gravacao em segundo plano registrada
+unsigned int inodeCacheHand = 0;	//Ponteiro do CLOCK
+InodeCacheStats inodeCacheStats;	//Contadores da cache
+pthread_mutex_t inodeCacheLock;	//Protege a cache e os mapas de i-nodes
+					//livres (recursivo: as funcoes publicas
+					//chamam umas as outras)
+pthread_once_t inodeCacheLockOnce = PTHREAD_ONCE_INIT; //Inicia o lock
+
+//Tipo para representacao do espelho em memoria do mapa de i-nodes livres de
+//um disco. O bit number-1 e' 1 se o i-node number estiver em uso (primeiro
+//endereco de bloco diferente de 0). O mapa ocupa os setores seguintes a area
+//de i-nodes e e' descrito no setor INODE_MAPSECTOR
+typedef struct inode_map {
+	Disk *d;			//Disco do mapa
+	unsigned long long *words;	//Bits do mapa (padding final em 1)
+	unsigned int numInodes;		//I-nodes da area (0: disco sem mapa)
+	unsigned int numFree;		//I-nodes livres
+	unsigned int hint;		//Todo i-node anterior a hint esta em uso
+	unsigned long int base;		//Primeiro setor do mapa no disco
+	struct inode_map *next;		//Proximo mapa da lista
+} InodeMap;
+
+InodeMap *inodeMaps = NULL;	//Mapas dos discos ja consultados
+
+//Funcao interna que retorna o setor no qual se encontra o i-node number
+unsigned long int __inodeSectorAddr (unsigned int number) {
+	return INODE_BEGINSECTOR + (number - 1) * INODE_SIZE 
+	       * sizeof (unsigned int) / DISK_SECTORDATASIZE;
+}
+
+//Funcao interna que retorna a posicao de inicio do i-node number dentro de
+//seu setor
+unsigned long int __inodeSectorOffset (unsigned int number) {
+	unsigned long int sizeUInt = sizeof(unsigned int);
+	return ((number - 1) % (DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
+	       * INODE_SIZE * sizeUInt;
+}
+
+//Funcao interna que preenche o i-node i, do disco d, com os INODE_SIZE
+//valores ja decodificados em words
+void __inodeFromWords (Inode *i, unsigned int *words, Disk *d) {
+	i->d = d;
+	memcpy (i->inodeItem, words, NUMITEMS_PERINODE * sizeof (unsigned int));
+	i->number = words[INODE_SIZE-2];
+	i->next = words[INODE_SIZE-1];
+}
+
+//Funcao interna que copia o i-node i para os INODE_SIZE valores em words
+void __inodeToWords (Inode *i, unsigned int *words) {
+	memcpy (words, i->inodeItem, NUMITEMS_PERINODE * sizeof (unsigned int));
+	words[INODE_SIZE-2] = i->number;
+	words[INODE_SIZE-1] = i->next;
+}
+
+//Funcao interna que codifica o i-node i, de numero number, em sua posicao
+//no setor sector
+void __inodeEncode (Inode *i, unsigned int number, unsigned char *sector) {
+	unsigned int words[INODE_SIZE];
+
+	//Alterando enderecos de blocos e atributos do i-node no setor
+	__inodeToWords (i, words);
+	ul2charArray (words, &sector[__inodeSectorOffset (number)], INODE_SIZE);
+}
+
+//Funcao interna que grava o i-node i, de numero number, em seu setor.
+//Retorna 0 ou -1
+int __inodeWriteBack (Inode *i, unsigned int number) {
+	unsigned long int inodeSectorAddr = __inodeSectorAddr (number);
+	unsigned char sector[DISK_SECTORDATASIZE];
+
+	int ret = bcacheReadSector (i->d, inodeSectorAddr, sector);
+	if (ret < 0) return ret;
+	__inodeEncode (i, number, sector);
+
+	//Salvando todo o setor onde se encontra o i-node...
+	return bcacheWriteSector (i->d, inodeSectorAddr, sector);
+}
+
+//Funcao interna que le e decodifica o i-node number do disco d em *i.
+//Retorna 0 ou -1
+int __inodeReadIn (Inode *i, unsigned int number, Disk *d) {
+	unsigned long int offset = __inodeSectorOffset (number);
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int words[INODE_SIZE];
+
+	int ret = bcacheReadSector (d, __inodeSectorAddr (number), sector);
+	if (ret < 0) return ret;
+
+	//Recuperando enderecos de blocos e atributos do i-node no setor
+	char2ulArray (&sector[offset], words, INODE_SIZE);
+	__inodeFromWords (i, words, d);
+	return 0;
+}
+
+//Funcao interna que inicia inodeCacheLock como mutex recursivo
+void __inodeLockInit (void) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (&inodeCacheLock, &attr);
+	pthread_mutexattr_destroy (&attr);
+}
+
+//Funcao interna que adquire inodeCacheLock
+void __inodeLock (void) {
+	pthread_once (&inodeCacheLockOnce, __inodeLockInit);
+	pthread_mutex_lock (&inodeCacheLock);
+}
+
+//Funcao interna que retorna o balde da tabela hash do i-node number de d
+unsigned int __inodeCacheHash (Disk *d, unsigned int number) {
+	return hashKey (d, number) % INODE_CACHESIZE;
+}
+
+//Funcao interna que retorna a entrada do i-node number de d ou -1 se o
+//i-node nao estiver na cache
+int __inodeCacheLookup (Disk *d, unsigned int number) {
+	int e;
+	if (!inodeCacheReady) {
+		for (e = 0; e < INODE_CACHESIZE; e++)
+			inodeCacheBuckets[e] = -1;
+		inodeCacheStats.numEntries = INODE_CACHESIZE;
+		inodeCacheReady = 1;
+	}
+	e = inodeCacheBuckets[__inodeCacheHash (d, number)];
+	while (e >= 0 && 
+	       (inodeCache[e].d != d || inodeCache[e].number != number))
+		e = inodeCache[e].hashNext;
+	return e;
+}
+
+//Funcao interna que retorna a entrada da cache cujo i-node e' i ou -1 se i
+//nao for uma referencia obtida da cache
+int __inodeCacheEntry (Inode *i) {
+	unsigned char *p = (unsigned char *) i, *base = (unsigned char *) inodeCache;
+	int e;
+	if (p < base || p >= base + sizeof (inodeCache) ||
+	    (p - base) % sizeof (InodeCacheEntry) != 0)
+		return -1;
+	e = (p - base) / sizeof (InodeCacheEntry);
+	return (inodeCache[e].d ? e : -1);
+}
+
+//Funcao interna que remove a entrada e de seu balde e a torna livre
+void __inodeCacheDrop (int e) {
+	int *link = &inodeCacheBuckets[__inodeCacheHash (inodeCache[e].d,
+	                                                 inodeCache[e].number)];
+	while (*link != e) link = &inodeCache[*link].hashNext;
+	*link = inodeCache[e].hashNext;
+	if (inodeCache[e].dirty) inodeCacheStats.dirtyEntries--;
+	free (inodeCache[e].extents);
+	inodeCache[e].extents = NULL;
+	inodeCache[e].tail = 0;
+	inodeCache[e].d = NULL;
+	inodeCache[e].dirty = 0;
+	inodeCache[e].ref = 0;
+}
+
+//Funcao interna que grava o i-node sujo da entrada e em seu setor junto com
+//os demais i-nodes sujos do mesmo setor presentes na cache (apenas os sem
+//referencias em uso, se idleOnly), com uma unica leitura e uma unica escrita
+//do setor. Retorna 0 ou -1
+int __inodeCacheWriteBack (int e, int idleOnly) {
+	Disk *d = inodeCache[e].d;
+	unsigned int first = inodeCache[e].number 
+	                     - (inodeCache[e].number - 1) % INODE_PERSECTOR;
+	unsigned long int sectorAddr = __inodeSectorAddr (first);
+	unsigned char sector[DISK_SECTORDATASIZE];
+	int members[INODE_PERSECTOR], numMembers = 0;
+
+	if (bcacheReadSector (d, sectorAddr, sector) < 0) return -1;
+	for (unsigned int n = first; n < first + INODE_PERSECTOR; n++) {
+		int m = __inodeCacheLookup (d, n);
+		if (m < 0 || !inodeCache[m].dirty ||
+		    (idleOnly && inodeCache[m].refs && m != e))
+			continue;
+		__inodeEncode (&inodeCache[m].inode, n, sector);
+		members[numMembers++] = m;
+	}
+	if (bcacheWriteSector (d, sectorAddr, sector) < 0) return -1;
+	for (int a = 0; a < numMembers; a++)
+		inodeCache[members[a]].dirty = 0;
+	inodeCacheStats.dirtyEntries -= numMembers;
+	inodeCacheStats.writebacks += numMembers;
+	inodeCacheStats.sectorWrites++;
+	return 0;
+}
+
+//Funcao interna executada pela thread de gravacao em segundo plano da cache
+//de setores (bcacheSetWritebackHook). Grava em seus setores os i-nodes sujos
+//ha mais de dirtyAgeMs milissegundos ou, se os i-nodes sujos excederem
+//dirtyRatio por cento da cache, todos os i-nodes sujos. I-nodes com
+//referencias em uso (inodeGet) nao sao gravados. Retorna o numero de
+//i-nodes gravados ou -1 em caso de erro
+int __inodeFlushExpired (unsigned long dirtyAgeMs, unsigned int dirtyRatio) {
+	unsigned long now = nowUs ();
+	unsigned long before;
+	int all, ret = 0;
+	__inodeLock ();
+	before = inodeCacheStats.writebacks;
+	all = (inodeCacheStats.dirtyEntries * 100UL >= 
+	       (unsigned long) dirtyRatio * INODE_CACHESIZE);
+	for (int e = 0; e < INODE_CACHESIZE; e++)
+		if (inodeCache[e].d && inodeCache[e].dirty && !inodeCache[e].refs &&
+		    (all || now - inodeCache[e].dirtySince >= dirtyAgeMs * 1000) &&
+		    __inodeCacheWriteBack (e, 1) < 0)
+			ret = -1;
+	if (ret == 0) ret = inodeCacheStats.writebacks - before;
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
+
+//Funcao interna que decide, para clockSelect, se a entrada e pode ser
+//substituida. Entradas com referencias em uso sao sempre poupadas, e as
+//referenciadas, uma vez. Um i-node sujo e' gravado antes; se a gravacao
+//falhar, a entrada e' poupada
+int __inodeCacheCanReplace (unsigned int e) {
+	if (!inodeCache[e].d) return 1;
+	if (inodeCache[e].refs) return 0;
+	if (inodeCache[e].ref) {
+		inodeCache[e].ref = 0;
+		return 0;
+	}
+	return (!inodeCache[e].dirty || __inodeCacheWriteBack (e, 0) == 0);
+}
+
+//Funcao interna que obtem uma entrada para o i-node number de d, ausente da
+//cache, substituindo a entrada escolhida pelo algoritmo CLOCK (clockSelect
+//e __inodeCacheCanReplace). Retorna a entrada, ja associada ao i-node, ou
+//-1 se nenhuma entrada puder ser substituida
+int __inodeCacheAlloc (Disk *d, unsigned int number) {
+	unsigned int h;
+	int e = clockSelect (&inodeCacheHand, INODE_CACHESIZE,
+	                     __inodeCacheCanReplace);
+	if (e < 0) return -1;
+	if (inodeCache[e].d) {
+		__inodeCacheDrop (e);
+		inodeCacheStats.evictions++;
+	}
+	h = __inodeCacheHash (d, number);
+	inodeCache[e].d = d;
+	inodeCache[e].number = number;
+	inodeCache[e].refs = 0;
+	inodeCache[e].hashNext = inodeCacheBuckets[h];
+	inodeCacheBuckets[h] = e;
+	return e;
+}
+
+//Funcao interna que retorna o numero de setores do mapa de uma area de
+//numInodes i-nodes
+unsigned int __inodeMapNumSectors (unsigned int numInodes) {
+	return (numInodes + INODE_MAPBITS - 1) / INODE_MAPBITS;
+}
+
+//Funcao interna que codifica em data o setor s do mapa m (palavras em
+//little-endian, bit number-1 no byte (number-1)/8)
+void __inodeMapEncode (InodeMap *m, unsigned int s, unsigned char *data) {
+	unsigned int perSector = INODE_MAPBITS / INODE_MAPWORDBITS;
+	unsigned int numWords = __inodeMapNumSectors (m->numInodes) * perSector;
+	for (unsigned int w = 0; w < perSector; w++) {
+		unsigned long long word = 0;
+		if (s * perSector + w < numWords) word = m->words[s * perSector + w];
+		for (int b = 0; b < 8; b++)
+			data[w * 8 + b] = (word >> (8 * b)) & 0xff;
+	}
+}
+
+//Funcao interna que cria o espelho de um mapa de numInodes i-nodes, todos
+//livres, iniciado no setor base de d. Retorna NULL se nao houver memoria
+InodeMap* __inodeMapNew (Disk *d, unsigned int numInodes,
+                         unsigned long int base) {
+	unsigned int numWords = __inodeMapNumSectors (numInodes) 
+	                        * (INODE_MAPBITS / INODE_MAPWORDBITS);
+	InodeMap *m = malloc (sizeof (InodeMap));
+	if (!m) return NULL;
+	m->words = calloc (numWords ? numWords : 1, sizeof (unsigned long long));
+	if (!m->words) {
+		free (m);
+		return NULL;
+	}
+	//Bits alem do ultimo i-node ficam em 1 e nunca sao encontrados livres
+	for (unsigned int n = numInodes; n < numWords * INODE_MAPWORDBITS; n++)
+		m->words[n / INODE_MAPWORDBITS] |= 1ULL << (n % INODE_MAPWORDBITS);
+	m->d = d;
+	m->numInodes = numInodes;
+	m->numFree = numInodes;
+	m->hint = 0;
+	m->base = base;
+	m->next = inodeMaps;
+	inodeMaps = m;
+	return m;
+}
+
+//Funcao interna que remove da memoria o mapa do disco d, se carregado
+void __inodeMapDrop (Disk *d) {
+	InodeMap **link = &inodeMaps;
+	while (*link && (*link)->d != d) link = &(*link)->next;
+	if (*link) {
+		InodeMap *m = *link;
+		*link = m->next;
+		free (m->words);
+		free (m);
+	}
+}
+
+//Funcao interna que retorna o mapa do disco d, lendo-o do disco na primeira
+//consulta. Um disco sem descritor em INODE_MAPSECTOR recebe um mapa com
+//numInodes 0. Retorna NULL em caso de erro de leitura ou falta de memoria
+InodeMap* __inodeMapGet (Disk *d) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int numInodes, base, numWords;
+	unsigned char *data;
+	InodeMap *m = inodeMaps;
+	while (m && m->d != d) m = m->next;
+	if (m) return m;
+	if (bcacheReadSector (d, INODE_MAPSECTOR, sector) < 0) return NULL;
+	if (memcmp (sector, INODE_MAPMAGIC, 8) != 0) 
+		return __inodeMapNew (d, 0, 0);
+	char2ul (&sector[8], &numInodes);
+	char2ul (&sector[12], &base);
+	data = malloc (__inodeMapNumSectors (numInodes) * DISK_SECTORDATASIZE);
+	if (!data) return NULL;
+	if (bcacheReadSectors (d, base, __inodeMapNumSectors (numInodes),
+	                       data) < 0 || 
+	    !(m = __inodeMapNew (d, numInodes, base))) {
+		free (data);
+		return NULL;
+	}
+	numWords = __inodeMapNumSectors (numInodes) 
+	           * (INODE_MAPBITS / INODE_MAPWORDBITS);
+	m->numFree = 0;
+	for (unsigned int w = 0; w < numWords; w++) {
+		unsigned long long word = 0;
+		for (int b = 7; b >= 0; b--)
+			word = (word << 8) | data[w * 8 + b];
+		m->words[w] |= word;	//Preserva o padding em 1
+		m->numFree += INODE_MAPWORDBITS 
+		               - __builtin_popcountll (m->words[w]);
+	}
+	free (data);
+	return m;
+}
+
+//Funcao interna que atualiza no mapa de seu disco o estado (em uso ou livre)
+//do i-node i, conforme seu primeiro endereco de bloco. Se o bit mudar, o
+//setor do mapa que o contem e' gravado. Retorna 0 ou -1
+int __inodeMapUpdate (Inode *i) {
+	InodeMap *m = __inodeMapGet (i->d);
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int n = i->number - 1;
+	unsigned long long mask = 1ULL << (n % INODE_MAPWORDBITS);
+	int used = (i->inodeItem[INODE_ITEM_BLOCKADDR] != 0);
+	if (!m) return -1;
+	if (i->number > m->numInodes) return 0;	//Fora do mapa
+	if (!(m->words[n / INODE_MAPWORDBITS] & mask) == !used) return 0;
+	m->words[n / INODE_MAPWORDBITS] ^= mask;
+	if (used) m->numFree--;
+	else {
+		m->numFree++;
+		if (n < m->hint) m->hint = n;
+	}
+	__inodeMapEncode (m, n / INODE_MAPBITS, sector);
+	return bcacheWriteSector (i->d, m->base + n / INODE_MAPBITS, sector);
+}
+
+//Funcao interna que registra na entrada da cache do i-node i (primeiro da
+//cadeia) o ultimo i-node da cadeia, tail, e o limite inferior slot do
+//primeiro item livre nele. A entrada e' lida se ausente
+void __inodeSetTail (Inode *i, unsigned int tail, unsigned int slot) {
+	int e = __inodeCacheLookup (i->d, i->number);
+	if (e < 0) {
+		Inode *h = inodeGet (i->number, i->d);
+		if (!h) return;
+		e = __inodeCacheEntry (h);
+		inodePut (h);
+	}
+	inodeCache[e].tail = tail;
+	inodeCache[e].tailSlot = slot;
+}
+
+//Funcao interna que retorna a ultima extensao de um i-node, como referencia
+//da cache a ser devolvida com inodePut, e em *slot o limite inferior do
+//primeiro item livre nela. A extensao registrada na entrada da cache do
+//i-node e' usada sem percorrer a cadeia. Retorna NULL se nao houver extensoes
+//do i-node fornecido.
+Inode* __inodeGetLastExtension (Inode *i, unsigned int *slot) {
 	unsigned int niNumber = 0;
 	Disk *d = i->d;
+	int e = __inodeCacheLookup (d, i->number);
+	*slot = 0;
+	if (e >= 0 && inodeCache[e].tail) {
+		*slot = inodeCache[e].tailSlot;
+		if (inodeCache[e].tail == i->number) return NULL;
+		return inodeGet (inodeCache[e].tail, d);
+	}
 	if (i->next) {
 		niNumber = i->next;
-		i = inodeLoad (niNumber, d);
+		i = inodeGet (niNumber, d);
 		if (!i) return NULL;
 	} 
 	else return NULL;
 	while (i->next != 0) {
 		niNumber = i->next;
-		free (i);
-		i = inodeLoad (niNumber, d);
+		inodePut (i);
+		i = inodeGet (niNumber, d);
 		if (!i) return NULL;
 	}
+	if (e >= 0) {
+		inodeCache[e].tail = niNumber;
+		inodeCache[e].tailSlot = 0;
+	}
 	return i;
 }
 
+//Funcao interna que retorna 1 se o i-node i usar o layout por extents
+int __inodeIsExtentMapped (Inode *i) {
+	return (i->inodeItem[INODE_ITEM_FILETYPE] & INODE_FLAG_EXTENTS) != 0;
+}
+
+//Funcao interna que le o extent k (0: primeiro item) de um i-node
+void __inodeExtentGet (Inode *i, unsigned int k, InodeExtent *x) {
+	unsigned int *item = &i->inodeItem[k * INODE_EXTENTITEMS];
+	x->physical = item[0];
+	x->logical = item[1];
+	x->length = item[2];
+}
+
+//Funcao interna que grava o extent x na posicao k de um i-node
+void __inodeExtentSet (Inode *i, unsigned int k, InodeExtent *x) {
+	unsigned int *item = &i->inodeItem[k * INODE_EXTENTITEMS];
+	item[0] = x->physical;
+	item[1] = x->logical;
+	item[2] = x->length;
+}
+
+//Funcao interna que descarta a tabela de extents e o fim da cadeia
+//registrados em memoria para o i-node number de d, se presentes
+void __inodeChainForget (Disk *d, unsigned int number) {
+	int e = __inodeCacheLookup (d, number);
+	if (e >= 0) {
+		free (inodeCache[e].extents);
+		inodeCache[e].extents = NULL;
+		inodeCache[e].tail = 0;
+	}
+}
+
+//Funcao interna que monta na entrada e a tabela com os extents de toda a
+//cadeia do i-node (com extents) da entrada. Retorna 0 ou -1
+int __inodeExtentLoad (int e) {
+	Inode *h = &inodeCache[e].inode, *ni;
+	unsigned int n = h->inodeItem[INODE_ITEM_NUMEXTENTS], k = 0;
+	unsigned int niNumber = h->next;
+	InodeExtent *x = malloc ((n ? n : 1) * sizeof (InodeExtent));
+	if (!x) return -1;
+	for (; k < n && k < NUMEXTENTS_PERINODE; k++)
+		__inodeExtentGet (h, k, &x[k]);
+	while (k < n) {
+		ni = niNumber ? inodeGet (niNumber, h->d) : NULL;
+		if (!ni) {
+			free (x);
+			return -1;
+		}
+		for (unsigned int a = 0; a < NUMEXTENTS_PEREXT && k < n; a++, k++)
+			__inodeExtentGet (ni, a, &x[k]);
+		niNumber = ni->next;
+		inodePut (ni);
+	}
+	inodeCache[e].extents = x;
+	return 0;
+}
+
+//Funcao interna que retorna o endereco do bloco blockNum de um i-node com
+//extents, por busca binaria na tabela de extents em memoria (montada na
+//primeira consulta). Retorna 0 se o bloco nao possuir endereco
+unsigned int __inodeExtentLookup (Inode *i, unsigned int blockNum) {
+	Inode *h = inodeGet (i->number, i->d);
+	unsigned int addr = 0, lo = 0, hi;
+	InodeExtent *x;
+	int e;
+	if (!h) return 0;
+	e = __inodeCacheEntry (h);
+	if (blockNum >= h->inodeItem[INODE_ITEM_NUMBLOCKS] ||
+	    (!inodeCache[e].extents && __inodeExtentLoad (e) < 0)) {
+		inodePut (h);
+		return 0;
+	}
+	x = inodeCache[e].extents;
+	hi = h->inodeItem[INODE_ITEM_NUMEXTENTS];
+	//Ultimo extent com bloco logico inicial <= blockNum
+	while (hi - lo > 1) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (x[mid].logical <= blockNum) lo = mid;
+		else hi = mid;
+	}
+	if (blockNum - x[lo].logical < x[lo].length)
+		addr = x[lo].physical + (blockNum - x[lo].logical);
+	inodePut (h);
+	return addr;
+}
+
+//Funcao interna que adiciona o endereco blockAddr ao fim de um i-node com
+//extents. Um bloco fisicamente contiguo ao ultimo extent apenas o estende;
+//caso contrario, um novo extent e' criado no primeiro i-node da cadeia, na
+//ultima extensao ou em uma nova extensao. Retorna 0 ou -1
+int __inodeExtentAddBlock (Inode *i, unsigned int blockAddr) {
+	unsigned int n = i->inodeItem[INODE_ITEM_NUMEXTENTS];
+	unsigned int numBlocks = i->inodeItem[INODE_ITEM_NUMBLOCKS];
+	Inode *holder = i, *ni;
+	unsigned int slot = 0, niNumber;
+	InodeExtent x;
+	int e, ret = 0, grow;
+	if (blockAddr == 0) return -1;
+	if (n > NUMEXTENTS_PERINODE) {
+		holder = __inodeGetLastExtension (i, &slot);
+		if (!holder) return -1;
+		slot = (n - NUMEXTENTS_PERINODE - 1) % NUMEXTENTS_PEREXT;
+	}
+	else if (n > 0) slot = n - 1;
+	if (n > 0) __inodeExtentGet (holder, slot, &x);
+	grow = (n > 0 && x.physical + x.length == blockAddr);
+	if (grow) {
+		x.length++;
+		__inodeExtentSet (holder, slot, &x);
+		if (holder != i) ret = inodeSave (holder);
+	}
+	else {
+		x.logical = numBlocks;
+		x.physical = blockAddr;
+		x.length = 1;
+		if (n < NUMEXTENTS_PERINODE) __inodeExtentSet (i, n, &x);
+		else if (slot + 1 < NUMEXTENTS_PEREXT && holder != i) {
+			__inodeExtentSet (holder, slot + 1, &x);
+			ret = inodeSave (holder);
+		}
+		else {
+			//Ultimo i-node da cadeia cheio: obter nova extensao
+			niNumber = inodeFindFreeInode (holder->number, i->d);
+			ni = niNumber ? inodeGet (niNumber, i->d) : NULL;
+			if (!ni) ret = -1;
+			else {
+				__inodeExtentSet (ni, 0, &x);
+				ret = inodeSave (ni);
+				inodePut (ni);
+				holder->next = niNumber;
+				if (ret == 0 && holder != i) ret = inodeSave (holder);
+				if (ret == 0) __inodeSetTail (i, niNumber, 0);
+			}
+		}
+	}
+	if (holder != i) inodePut (holder);
+	if (ret < 0) return -1;
+	i->inodeItem[INODE_ITEM_NUMBLOCKS] = numBlocks + 1;
+	if (!grow) i->inodeItem[INODE_ITEM_NUMEXTENTS] = n + 1;
+	if (inodeSave (i) < 0) return -1;
+	//Tabela de extents em memoria acompanha a cadeia
+	e = __inodeCacheLookup (i->d, i->number);
+	if (e >= 0 && inodeCache[e].extents) {
+		InodeExtent *t = inodeCache[e].extents;
+		if (grow) t[n - 1].length++;
+		else if ((t = realloc (t, (n + 1) * sizeof (InodeExtent)))) {
+			t[n] = x;
+			inodeCache[e].extents = t;
+		}
+		else __inodeChainForget (i->d, i->number);
+	}
+	return 0;
+}
+
 //Funcao que retorna o numero de i-nodes por setor
 unsigned int inodeNumInodesPerSector ( void ) {
 	return DISK_SECTORDATASIZE / (INODE_SIZE * sizeof (unsigned int));
@@ -81,102 +679,400 @@ Inode* inodeCreate (unsigned int number, Disk *d) {
 	return NULL;
 }
 
-//Funcao que limpa todo o conteudo de um i-node. O i-node e' salvo em disco,
-//sobrescrevendo-o se ja existente. Retorna 0 se bem sucedido ou -1, caso contrario
-int inodeClear (Inode *i) {
+//Funcao que cria um i-node vazio com o layout por extents, como em
+//inodeCreate
+Inode* inodeCreateExtents (unsigned int number, Disk *d) {
+	Inode *i = inodeCreate (number, d);
+	if (!i) return NULL;
+	i->inodeItem[INODE_ITEM_FILETYPE] = INODE_FLAG_EXTENTS;
+	if (inodeSave (i) == 0) return i;
+	free (i);
+	return NULL;
+}
+
+//Funcao que retorna o numero de setores ocupados pelo mapa de i-nodes livres
+//de uma area de numSectors setores de i-nodes
+unsigned int inodeAreaNumMapSectors (unsigned int numSectors) {
+	return __inodeMapNumSectors (numSectors * inodeNumInodesPerSector());
+}
+
+//Funcao interna com o corpo de inodeCreateArea, chamada com inodeCacheLock
+//adquirido
+int __inodeCreateArea (unsigned int numSectors, Disk *d) {
+	unsigned int numInodes = numSectors * inodeNumInodesPerSector();
+	unsigned int mapSectors = __inodeMapNumSectors (numInodes);
+	unsigned char *sectors, *inodes;
+	InodeMap *m;
+	int ret;
+	if (numSectors < 1) return -1;
+	//Descritor do mapa, setores de i-nodes e mapa sao contiguos
+	sectors = calloc (1 + numSectors + mapSectors, DISK_SECTORDATASIZE);
+	if (!sectors) return -1;
+	__inodeMapDrop (d);
+	m = __inodeMapNew (d, numInodes, INODE_BEGINSECTOR + numSectors);
+	if (!m) {
+		free (sectors);
+		return -1;
+	}
+	memcpy (sectors, INODE_MAPMAGIC, 8);
+	ul2char (numInodes, &sectors[8]);
+	ul2char (m->base, &sectors[12]);
+	inodes = &sectors[(INODE_BEGINSECTOR - INODE_MAPSECTOR) 
+	                  * DISK_SECTORDATASIZE];
+	//Cada setor e' montado como valores e codificado de uma vez
+	for (unsigned int s = 0; s < numSectors; s++) {
+		unsigned int words[INODE_PERSECTOR * INODE_SIZE] = {0};
+		for (unsigned int k = 0; k < INODE_PERSECTOR; k++)
+			words[k * INODE_SIZE + INODE_SIZE-2] = 
+				s * INODE_PERSECTOR + k + 1;
+		ul2charArray (words, &inodes[s * DISK_SECTORDATASIZE],
+		              INODE_PERSECTOR * INODE_SIZE);
+	}
+	for (unsigned int s = 0; s < mapSectors; s++)
+		__inodeMapEncode (m, s, &inodes[(numSectors + s) 
+		                                * DISK_SECTORDATASIZE]);
+	ret = bcacheWriteSectors (d, INODE_MAPSECTOR, 1 + numSectors + mapSectors,
+	                          sectors);
+	free (sectors);
+	//I-nodes da area em cache passam a refletir os setores gravados
+	for (int e = 0; e < INODE_CACHESIZE; e++) {
+		InodeCacheEntry *c = &inodeCache[e];
+		if (c->d != d || c->number > numInodes) continue;
+		if (!c->refs) {
+			__inodeCacheDrop (e);
+			continue;
+		}
+		for (int a = 0; a < NUMITEMS_PERINODE; a++)
+			c->inode.inodeItem[a] = 0;
+		free (c->extents);
+		c->extents = NULL;
+		c->tail = 0;
+		c->inode.number = c->number;
+		c->inode.next = 0;
+		if (c->dirty) inodeCacheStats.dirtyEntries--;
+		c->dirty = 0;
+	}
+	return ret;
+}
+
+//Funcao que cria os i-nodes vazios contidos nos numSectors primeiros setores
+//da area de i-nodes, com uma unica escrita em disco. Os i-nodes existentes
+//nesses setores sao sobrescritos. O descritor do mapa de i-nodes livres e o
+//mapa, com todos os i-nodes livres, sao gravados na mesma escrita, no setor
+//anterior a area e nos setores seguintes. Retorna 0 se bem sucedido ou -1,
+//caso contrario
+int inodeCreateArea (unsigned int numSectors, Disk *d) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeCreateArea (numSectors, d);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
+
+//Funcao interna com o corpo de inodeClear, chamada com inodeCacheLock
+//adquirido
+int __inodeClear (Inode *i) {
 	if (i) {
-		if (i->next != 0) {
-			Inode* ni = inodeLoad (i->next, i->d);
+		//Extensoes sao limpas uma a uma, com uma unica referencia da
+		//cache em uso por vez
+		unsigned int niNumber = i->next;
+		while (niNumber != 0) {
+			Inode* ni = inodeGet (niNumber, i->d);
+			int ret;
 			if ( !ni ) return -1;
-			if ( inodeClear (ni) != 0 ) {
-				free (ni);
-				return -1;
-			}
-			free (ni);
-		}	
+			niNumber = ni->next;
+			ni->next = 0;
+			for (int a = 0; a < NUMITEMS_PERINODE; a++)
+				ni->inodeItem[a] = 0;
+			__inodeChainForget (ni->d, ni->number);
+			ret = inodeSave (ni);
+			inodePut (ni);
+			if ( ret != 0 ) return -1;
+		}
 		i->next = 0;
 		for (int a = 0; a < NUMITEMS_PERINODE; a++)
 			i->inodeItem[a] = 0;
+		__inodeChainForget (i->d, i->number);
 		return inodeSave(i);
 	}
 	return -1;
 }
 
+//Funcao que limpa todo o conteudo de um i-node. O i-node e' salvo em disco,
+//sobrescrevendo-o se ja existente. Retorna 0 se bem sucedido ou -1, caso contrario
+int inodeClear (Inode *i) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeClear (i);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
+
+//Funcao interna com o corpo de inodeSave, chamada com inodeCacheLock
+//adquirido
+int __inodeSave (Inode *i) {
+	if (i) {
+		int e = __inodeCacheEntry (i);
+		if (__inodeMapUpdate (i) < 0) return -1;
+		if (e < 0) {
+			//Copia privada (inodeLoad/inodeCreate): atualiza a cache
+			e = __inodeCacheLookup (i->d, i->number);
+			if (e < 0) e = __inodeCacheAlloc (i->d, i->number);
+			if (e < 0) return __inodeWriteBack (i, i->number);
+			inodeCache[e].inode = *i;
+		}
+		if (!inodeFlushHookReady) {
+			//I-nodes sujos seguem os limites da thread de gravacao
+			//em segundo plano da cache de setores
+			bcacheSetWritebackHook (__inodeFlushExpired);
+			inodeFlushHookReady = 1;
+		}
+		if (!inodeCache[e].dirty) {
+			inodeCache[e].dirty = 1;
+			inodeCache[e].dirtySince = nowUs ();
+			inodeCacheStats.dirtyEntries++;
+		}
+		inodeCache[e].ref = 1;
+		return 0;
+	}
+	return -1;
+}
+
 //Funcao que persiste um i-node em seu disco. Retorna 0 se gravacao bem sucedida
 //ou -1 caso contrario. I-nodes sao salvos a partir do setor INODE_1STSECTOR. Numero de
 //i-nodes por setor pode variar de acordo com o tamanho do tipo unsigned int
 //Em arquiteturas de 64 bits testadas, unsigned int ocupa 32 bits. Nesse caso,
-//cada setor pode receber 8 i-nodes 
+//cada setor pode receber 8 i-nodes. O i-node e' apenas marcado como sujo na
+//cache de i-nodes e gravado em seu setor na substituicao, em inodeSync ou
+//pela thread de gravacao em segundo plano (__inodeFlushExpired)
 int inodeSave (Inode *i) {
-	if (i) {
-		unsigned long int sizeUInt = sizeof(unsigned int);
-		//Endereco do setor no qual o i-node sera' salvo
-		unsigned long int inodeSectorAddr = 
-			INODE_BEGINSECTOR + (i->number - 1) * INODE_SIZE 
-			* sizeUInt / DISK_SECTORDATASIZE;
-		unsigned char sector[DISK_SECTORDATASIZE];
-
-		int ret = diskReadSector (i->d, inodeSectorAddr, sector);
-		if (ret < 0) return ret;
-
-		//Posicao de inicio do i-node dentro do setor
-		unsigned long int offset = ((i->number - 1) % 
-			   (DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
-                           * INODE_SIZE * sizeUInt;
-
-		//Alterando enderecos de blocos e atributos do i-node no setor
-		for (int a=0; a < NUMITEMS_PERINODE; a++)
-			ul2char (i->inodeItem[a], 
-			         &sector[offset+a*sizeUInt]);
-		ul2char (i->number, 
-		         &sector[offset+(INODE_SIZE-2)*sizeUInt]);
-		ul2char (i->next, 
-			 &sector[offset+(INODE_SIZE-1)*sizeUInt]);
-
-		//Salvando todo o setor onde se encontra o i-node...
-		ret = diskWriteSector (i->d, inodeSectorAddr, sector);
-		return ret;
-	}
-	return -1;
+	int ret;
+	__inodeLock ();
+	ret = __inodeSave (i);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
 }
 
 //Funcao que recupera um i-node a partir do disco. Retorna ponteiro para o
 //i-node lido ou NULL em caso de falha.
 Inode* inodeLoad (unsigned int number, Disk *d) {
-	unsigned long int sizeUInt = sizeof(unsigned int);
-	//Endereco do setor do qual o i-node sera' lido
-	unsigned long int inodeSectorAddr = 
-		INODE_BEGINSECTOR + (number - 1) * INODE_SIZE * sizeUInt
-		    / DISK_SECTORDATASIZE;
-	unsigned char sector[DISK_SECTORDATASIZE];
+	Inode *c = inodeGet (number, d);
 	Inode *i = NULL;
+	if (!c) return NULL;
+	i = malloc (sizeof(Inode));
+	if (i) *i = *c;
+	inodePut (c);
+	return i;
+}
 
-	int ret = diskReadSector (d, inodeSectorAddr, sector);
-	if (ret < 0) return NULL;
+//Funcao interna com o corpo de inodeLoadSector, chamada com inodeCacheLock
+//adquirido
+unsigned int __inodeLoadSector (unsigned int number, Disk *d, Inode **inodes) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int words[INODE_PERSECTOR * INODE_SIZE], first;
+	unsigned int k;
+	if (number < 1 || !inodes) return 0;
+	first = number - (number - 1) % INODE_PERSECTOR;
+	if (bcacheReadSector (d, __inodeSectorAddr (first), sector) < 0)
+		return 0;
+	char2ulArray (sector, words, INODE_PERSECTOR * INODE_SIZE);
+	for (k = 0; k < INODE_PERSECTOR; k++) {
+		int e = __inodeCacheLookup (d, first + k);
+		inodes[k] = malloc (sizeof (Inode));
+		if (!inodes[k]) break;
+		if (e >= 0) *inodes[k] = inodeCache[e].inode;
+		else __inodeFromWords (inodes[k], &words[k * INODE_SIZE], d);
+	}
+	if (k == INODE_PERSECTOR) return first;
+	while (k > 0) free (inodes[--k]);
+	return 0;
+}
 
-	//Posicao de inicio do i-node dentro do setor
-	unsigned long int offset = ((number - 1) % 
-		(DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
-		* INODE_SIZE * sizeUInt;
+//Funcao que le de uma vez os i-nodes do setor que contem o i-node number,
+//decodificando o setor inteiro em uma unica passada. I-nodes presentes na
+//cache de i-nodes sao copiados dela. Retorna o numero do primeiro i-node do
+//setor ou 0 em caso de falha
+unsigned int inodeLoadSector (unsigned int number, Disk *d, Inode **inodes) {
+	unsigned int ret;
+	__inodeLock ();
+	ret = __inodeLoadSector (number, d, inodes);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
 
-	i = malloc (sizeof(Inode));
-	if (i) {
-		i->d = d;
-		//Recuperando enderecos de blocos e atributos do i-node no setor
-		for (int a=0; a < NUMITEMS_PERINODE; a++)
-			char2ul (&sector[offset+a*sizeUInt],
-			         &(i->inodeItem[a]));
-		char2ul (&sector[offset+(INODE_SIZE-2)*sizeUInt],
-		         &(i->number));
-		char2ul (&sector[offset+(INODE_SIZE-1)*sizeUInt],
-		         &(i->next));
+//Funcao interna com o corpo de inodeSaveSector, chamada com inodeCacheLock
+//adquirido
+int __inodeSaveSector (Inode **inodes) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	unsigned int words[INODE_PERSECTOR * INODE_SIZE], first = 0;
+	int entries[INODE_PERSECTOR], partial = 0, count = 0;
+	Disk *d = NULL;
+	unsigned int k;
+	if (!inodes) return -1;
+	for (k = 0; k < INODE_PERSECTOR; k++) {
+		if (!inodes[k]) {
+			partial = 1;
+			continue;
+		}
+		if (!d) {
+			d = inodes[k]->d;
+			first = inodes[k]->number - k;
+		}
+		if (inodes[k]->d != d || inodes[k]->number != first + k ||
+		    first < 1 || (first - 1) % INODE_PERSECTOR != 0)
+			return -1;
 	}
-	return i;
+	if (!d) return -1;
+	if (partial) {
+		if (bcacheReadSector (d, __inodeSectorAddr (first), sector) < 0)
+			return -1;
+		char2ulArray (sector, words, INODE_PERSECTOR * INODE_SIZE);
+	}
+	for (k = 0; k < INODE_PERSECTOR; k++) {
+		Inode *i = inodes[k];
+		entries[k] = __inodeCacheLookup (d, first + k);
+		if (i) {
+			if (__inodeMapUpdate (i) < 0) return -1;
+		}
+		else if (entries[k] >= 0 && inodeCache[entries[k]].dirty)
+			i = &inodeCache[entries[k]].inode;	//Sujo em cache
+		else {
+			entries[k] = -1;
+			continue;
+		}
+		__inodeToWords (i, &words[k * INODE_SIZE]);
+	}
+	ul2charArray (words, sector, INODE_PERSECTOR * INODE_SIZE);
+	if (bcacheWriteSector (d, __inodeSectorAddr (first), sector) < 0)
+		return -1;
+	//Entradas da cache passam a refletir o setor gravado
+	for (k = 0; k < INODE_PERSECTOR; k++) {
+		InodeCacheEntry *c;
+		if (entries[k] < 0) continue;
+		c = &inodeCache[entries[k]];
+		if (inodes[k] && inodes[k] != &c->inode) {
+			if (memcmp (c->inode.inodeItem, inodes[k]->inodeItem,
+			            sizeof (c->inode.inodeItem)) != 0 ||
+			    c->inode.next != inodes[k]->next)
+				__inodeChainForget (d, first + k);
+			c->inode = *inodes[k];
+		}
+		if (c->dirty) {
+			c->dirty = 0;
+			inodeCacheStats.dirtyEntries--;
+		}
+		count++;
+	}
+	for (k = 0; k < INODE_PERSECTOR; k++)
+		if (inodes[k] && entries[k] < 0) count++;
+	inodeCacheStats.writebacks += count;
+	inodeCacheStats.sectorWrites++;
+	return 0;
+}
+
+//Funcao que grava de uma vez os i-nodes de um setor, com uma unica escrita
+int inodeSaveSector (Inode **inodes) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeSaveSector (inodes);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
+
+//Funcao interna com o corpo de inodeGet, chamada com inodeCacheLock
+//adquirido
+Inode* __inodeGet (unsigned int number, Disk *d) {
+	int e;
+	if (number < 1) return NULL;
+	e = __inodeCacheLookup (d, number);
+	if (e >= 0) inodeCacheStats.hits++;
+	else {
+		e = __inodeCacheAlloc (d, number);
+		if (e < 0) return NULL;
+		if (__inodeReadIn (&inodeCache[e].inode, number, d) < 0) {
+			__inodeCacheDrop (e);
+			return NULL;
+		}
+		inodeCacheStats.misses++;
+	}
+	inodeCache[e].refs++;
+	inodeCache[e].ref = 1;
+	return &inodeCache[e].inode;
+}
+
+//Funcao que obtem da cache de i-nodes uma referencia ao i-node number
+Inode* inodeGet (unsigned int number, Disk *d) {
+	Inode* ret;
+	__inodeLock ();
+	ret = __inodeGet (number, d);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
+
+//Funcao que devolve uma referencia obtida por inodeGet
+void inodePut (Inode *i) {
+	int e;
+	__inodeLock ();
+	e = __inodeCacheEntry (i);
+	if (e >= 0 && inodeCache[e].refs > 0) inodeCache[e].refs--;
+	pthread_mutex_unlock (&inodeCacheLock);
+}
+
+//Funcao interna com o corpo de inodeSync, chamada com inodeCacheLock
+//adquirido
+int __inodeSync (Disk *d) {
+	int ret = 0;
+	for (int e = 0; e < INODE_CACHESIZE; e++)
+		if (inodeCache[e].d && (!d || inodeCache[e].d == d) &&
+		    inodeCache[e].dirty && __inodeCacheWriteBack (e, 0) < 0)
+			ret = -1;
+	return ret;
+}
+
+//Funcao que grava em seus setores os i-nodes sujos do disco d (de todos os
+//discos se d for NULL). Cada setor e' gravado uma vez, com todos os seus
+//i-nodes sujos
+int inodeSync (Disk *d) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeSync (d);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
+
+//Funcao interna com o corpo de inodeCacheInvalidate, chamada com inodeCacheLock
+//adquirido
+int __inodeCacheInvalidate (Disk *d) {
+	int ret = inodeSync (d);
+	__inodeMapDrop (d);
+	for (int e = 0; e < INODE_CACHESIZE; e++)
+		if (inodeCache[e].d != d) continue;
+		else if (inodeCache[e].refs) ret = -1;
+		else __inodeCacheDrop (e);
+	return ret;
+}
+
+//Funcao que grava os i-nodes sujos do disco d e os remove da cache
+int inodeCacheInvalidate (Disk *d) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeCacheInvalidate (d);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
+
+//Funcao que copia para *stats os contadores da cache de i-nodes
+void inodeCacheGetStats (InodeCacheStats *stats) {
+	__inodeLock ();
+	*stats = inodeCacheStats;
+	pthread_mutex_unlock (&inodeCacheLock);
+	stats->numEntries = INODE_CACHESIZE;
 }
 
 //Funcao que modifica o tipo de arquivo referente a um i-node
 void inodeSetFileType (Inode *i, unsigned int fileType) {
-	if (i) i->inodeItem[INODE_ITEM_FILETYPE] = fileType;
+	if (i) i->inodeItem[INODE_ITEM_FILETYPE] = (fileType & ~INODE_FLAG_EXTENTS)
+		| (i->inodeItem[INODE_ITEM_FILETYPE] & INODE_FLAG_EXTENTS);
 }
 
 //Funcao que modifica o tamanho do arquivo referente a um i-node, em bytes
@@ -204,30 +1100,32 @@ void inodeSetRefCount (Inode *i, unsigned int refCount) {
 	if (i) i->inodeItem[INODE_ITEM_REFCOUNT] = refCount;
 }
 
-//Funcao que adiciona um endereco ao fim do array de blocos de um i-node
-//Retorna -1 caso a inclusao do endereco nao seja bem sucedida
-//E' a unica funcao que salva automaticamente o i-node em disco
-int inodeAddBlock (Inode *i, unsigned int blockAddr) {
+//Funcao interna com o corpo de inodeAddBlock, chamada com inodeCacheLock
+//adquirido
+int __inodeAddBlock (Inode *i, unsigned int blockAddr) {
 	if (i) {
 		Disk *d = i->d;
 		Inode* lastInodeExt = NULL;
-		unsigned int niNumber;
+		unsigned int niNumber, slot;
 		int ret, numblocks = NUMBLOCKS_PERINODE;
-		lastInodeExt = __inodeGetLastExtension (i);
-		if (lastInodeExt) {
-			numblocks = NUMITEMS_PERINODE;
-			if ( inodeSave (i) < 0 ) return -1;
-		}
+		if (__inodeIsExtentMapped (i))
+			return __inodeExtentAddBlock (i, blockAddr);
+		//Fim da cadeia registrado na cache: o i-node i so' e' salvo se
+		//for o ultimo da cadeia ou receber a primeira extensao
+		lastInodeExt = __inodeGetLastExtension (i, &slot);
+		if (lastInodeExt) numblocks = NUMITEMS_PERINODE;
 		else if (i->next != 0) return -1;
 		else lastInodeExt = i;
 
-		for (int a = 0; a < numblocks; a++)
+		for (int a = slot; a < numblocks; a++)
 			//Encontrar bloco sem endereco
 			if (lastInodeExt->inodeItem[a] == 0) {
 				lastInodeExt->inodeItem[a] = blockAddr;
 				ret = inodeSave(lastInodeExt);
+				__inodeSetTail (i, lastInodeExt->number,
+				                blockAddr ? a + 1 : a);
 				if (numblocks != NUMBLOCKS_PERINODE) 
-					free (lastInodeExt);
+					inodePut (lastInodeExt);
 				return ret;
 			}
 		//i-node esta' sem bloco a preencher. Obter nova extensao
@@ -236,24 +1134,36 @@ int inodeAddBlock (Inode *i, unsigned int blockAddr) {
 			lastInodeExt->next = niNumber;
 			ret = inodeSave (lastInodeExt);
 			if (numblocks != NUMBLOCKS_PERINODE) 
-				free (lastInodeExt);
+				inodePut (lastInodeExt);
 			if (ret < 0) return ret;
 		}
 		else {
 			if (numblocks != NUMBLOCKS_PERINODE)
-				free (lastInodeExt);
+				inodePut (lastInodeExt);
 			return -1;
 		}
-		lastInodeExt = inodeLoad (niNumber, d);
+		lastInodeExt = inodeGet (niNumber, d);
 		if (!lastInodeExt) return -1;
 		lastInodeExt->inodeItem[0] = blockAddr;
 		ret = inodeSave (lastInodeExt);
-		free (lastInodeExt);
+		inodePut (lastInodeExt);
+		if (ret == 0) __inodeSetTail (i, niNumber, blockAddr ? 1 : 0);
 		return ret;
 	}
 	return -1;
 }
 
+//Funcao que adiciona um endereco ao fim do array de blocos de um i-node
+//Retorna -1 caso a inclusao do endereco nao seja bem sucedida
+//E' a unica funcao que salva automaticamente o i-node em disco
+int inodeAddBlock (Inode *i, unsigned int blockAddr) {
+	int ret;
+	__inodeLock ();
+	ret = __inodeAddBlock (i, blockAddr);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
+
 //Funcao que retorna o numero de um i-node.
 unsigned int inodeGetNumber (Inode *i) {
 	return (i ? i->number : 0);
@@ -267,7 +1177,7 @@ unsigned int inodeGetNextNumber (Inode *i) {
 
 //Funcao que retorna o tipo de arquivo referente a um i-node.
 unsigned int inodeGetFileType (Inode *i) {
-	return (i ? i->inodeItem[INODE_ITEM_FILETYPE] : 0);
+	return (i ? i->inodeItem[INODE_ITEM_FILETYPE] & ~INODE_FLAG_EXTENTS : 0);
 }
 
 //Funcao que retorna o tamanho do arquivo referente ao i-node, em bytes
@@ -299,12 +1209,13 @@ unsigned int inodeGetRefCount (Inode *i) {
 }
 
 
-//Funcao que retorna o endereco correspondente a um bloco (blockNum) no array
-//de blocos de um i-node. O i-node precisa ser o primeiro de sua cadeia.
-//Retorna 0 se o bloco nao possuir endereco em blockNum
-unsigned int inodeGetBlockAddr (Inode *i, unsigned int blockNum) {
+//Funcao interna com o corpo de inodeGetBlockAddr, chamada com inodeCacheLock
+//adquirido
+unsigned int __inodeGetBlockAddr (Inode *i, unsigned int blockNum) {
 	unsigned int numblocks = NUMBLOCKS_PERINODE;
 	if (i) {
+		if (__inodeIsExtentMapped (i))
+			return __inodeExtentLookup (i, blockNum);
 		if (blockNum < NUMBLOCKS_PERINODE)
 			return i->inodeItem[blockNum];
 		else {
@@ -313,31 +1224,111 @@ unsigned int inodeGetBlockAddr (Inode *i, unsigned int blockNum) {
 			                      / NUMITEMS_PERINODE;
 			unsigned int offset = (blockNum - NUMBLOCKS_PERINODE)
 			                      % NUMITEMS_PERINODE;
-			Inode *ni = inodeLoad (i->next, i->d);
-			for (int a = 1; a < extNum; a++) {
+			Inode *ni = inodeGet (i->next, i->d);
+			unsigned int addr;
+			for (int a = 1; a < extNum && ni; a++) {
 				Disk *d = ni->d;
 				unsigned int niNumber = ni->next;
-				free (ni);
-				ni = inodeLoad (niNumber, d);
+				inodePut (ni);
+				ni = inodeGet (niNumber, d);
 			}
-			return ni->inodeItem[offset];
+			if (!ni) return 0;
+			addr = ni->inodeItem[offset];
+			inodePut (ni);
+			return addr;
 		}
 	}
 	return 0;
 }
 
+//Funcao que retorna o endereco correspondente a um bloco (blockNum) no array
+//de blocos de um i-node. O i-node precisa ser o primeiro de sua cadeia.
+//Retorna 0 se o bloco nao possuir endereco em blockNum
+unsigned int inodeGetBlockAddr (Inode *i, unsigned int blockNum) {
+	unsigned int ret;
+	__inodeLock ();
+	ret = __inodeGetBlockAddr (i, blockNum);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
+}
+
+//Funcao interna que encontra o primeiro bit 0 do mapa m a partir do i-node
+//startFrom, uma palavra por vez. A busca comeca em m->hint quando startFrom
+//for anterior a ele, avancando-o. Retorna o numero do i-node ou 0
+unsigned int __inodeMapFindFree (InodeMap *m, unsigned int startFrom) {
+	unsigned int n = startFrom - 1, fromHint = 0, w;
+	unsigned int numWords = __inodeMapNumSectors (m->numInodes)
+	                        * (INODE_MAPBITS / INODE_MAPWORDBITS);
+	unsigned long long word;
+	if (startFrom > m->numInodes || m->numFree == 0) return 0;
+	if (n <= m->hint) {
+		n = m->hint;
+		fromHint = 1;
+	}
+	w = n / INODE_MAPWORDBITS;
+	word = ~m->words[w] & (~0ULL << (n % INODE_MAPWORDBITS));
+	while (!word) {
+		if (++w == numWords) return 0;
+		word = ~m->words[w];
+	}
+	n = w * INODE_MAPWORDBITS + __builtin_ctzll (word);
+	if (fromHint) m->hint = n;
+	return n + 1;
+}
+
+//Funcao interna com o corpo de inodeFindFreeInode, chamada com inodeCacheLock
+//adquirido
+unsigned int __inodeFindFreeInode (unsigned int startFrom, Disk *d) {
+	unsigned long int sizeUInt = sizeof(unsigned int);
+	unsigned int perSector = inodeNumInodesPerSector();
+	unsigned char sectors[INODE_SCANSECTORS * DISK_SECTORDATASIZE];
+	unsigned long int sectorAddr, numSectors = diskGetNumSectors (d);
+	unsigned int number;
+	InodeMap *m;
+	if (startFrom < 1) return 0;
+	m = __inodeMapGet (d);
+	if (!m) return 0;
+	if (m->numInodes) return __inodeMapFindFree (m, startFrom);
+	//Disco formatado sem mapa: busca linear nos setores de i-nodes
+	//A busca le os setores: i-nodes sujos em cache sao gravados antes
+	if (inodeSync (d) < 0) return 0;
+	//A area de i-nodes e' lida em faixas de setores, em uma unica chamada
+	//por faixa, e apenas o primeiro endereco de bloco e o numero de cada
+	//i-node sao decodificados
+	sectorAddr = INODE_BEGINSECTOR + (startFrom - 1) / perSector;
+	number = startFrom;
+	while (sectorAddr < numSectors) {
+		unsigned long int count = INODE_SCANSECTORS;
+		if (count > numSectors - sectorAddr)
+			count = numSectors - sectorAddr;
+		if (bcacheReadSectors (d, sectorAddr, count, sectors) < 0) break;
+		for (unsigned long int s = 0; s < count; s++)
+			for (; number <= (sectorAddr + s - INODE_BEGINSECTOR + 1)
+			                  * perSector; number++) {
+				unsigned int blockAddr, storedNumber;
+				unsigned long int offset = s * DISK_SECTORDATASIZE
+					+ ((number - 1) % perSector)
+					* INODE_SIZE * sizeUInt;
+				char2ul (&sectors[offset + INODE_ITEM_BLOCKADDR
+				                  * sizeUInt], &blockAddr);
+				char2ul (&sectors[offset + (INODE_SIZE-2)
+				                  * sizeUInt], &storedNumber);
+				if (blockAddr == 0 && storedNumber != 0)
+					return storedNumber;
+			}
+		sectorAddr += count;
+	}
+	return 0;
+}
+
 //Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
 //startFrom. Retorna o numero do inode livre encontrado ou 0 se nao encontrado.
+//Em discos com mapa de i-nodes livres, a busca e' feita no espelho em memoria
+//do mapa, sem leituras de setores de i-nodes
 unsigned int inodeFindFreeInode (unsigned int startFrom, Disk *d) {
-	Inode *i = NULL;
-	unsigned int number = 0;
-	if (startFrom < 1) return 0;
-	for (unsigned int a = startFrom; number == 0; a++) {
-		i = inodeLoad (a, d);
-		if (!i) break;
-		if (inodeGetBlockAddr(i, 0) == 0)
-			number = inodeGetNumber(i);
-		free (i);
-	}
-	return number;
+	unsigned int ret;
+	__inodeLock ();
+	ret = __inodeFindFreeInode (startFrom, d);
+	pthread_mutex_unlock (&inodeCacheLock);
+	return ret;
 }
@@ -18,6 +18,18 @@
 //Tipo para representacao de i-nodes
 typedef struct inode Inode;
 
+//Tipo de dados para a representacao dos contadores da cache de i-nodes
+typedef struct inode_cache_stats {
+	unsigned long hits;		//I-nodes encontrados em memoria
+	unsigned long misses;		//I-nodes lidos e decodificados do setor
+	unsigned long evictions;	//I-nodes substituidos (CLOCK)
+	unsigned long writebacks;	//I-nodes sujos gravados em seus setores
+	unsigned long sectorWrites;	//Setores gravados (um por setor, com
+					//todos os seus i-nodes sujos)
+	unsigned int numEntries;	//Capacidade da cache, em i-nodes
+	unsigned int dirtyEntries;	//I-nodes sujos presentes na cache
+} InodeCacheStats;
+
 //Funcao que retorna o numero de i-nodes por setor
 unsigned int inodeNumInodesPerSector ( void );
 
@@ -31,6 +43,24 @@ unsigned int inodeAreaBeginSector ( void );
 //existente
 Inode* inodeCreate (unsigned int number, Disk *d);
 
+//Funcao que cria um i-node vazio, como em inodeCreate, que mapeia seus blocos
+//por extents (bloco logico inicial, bloco fisico inicial e comprimento) em
+//vez de um endereco por bloco. Blocos contiguos adicionados por
+//inodeAddBlock estendem o ultimo extent, e inodeGetBlockAddr faz busca
+//binaria nos extents. inodeClear devolve o i-node ao layout comum
+Inode* inodeCreateExtents (unsigned int number, Disk *d);
+
+//Funcao que retorna o numero de setores ocupados pelo mapa de i-nodes livres
+//de uma area de numSectors setores de i-nodes, gravado logo apos a area
+unsigned int inodeAreaNumMapSectors (unsigned int numSectors);
+
+//Funcao que cria os i-nodes vazios contidos nos numSectors primeiros setores
+//da area de i-nodes, com uma unica escrita em disco. Os i-nodes existentes
+//nesses setores sao sobrescritos. O mapa de i-nodes livres (setor anterior a
+//area e inodeAreaNumMapSectors setores seguintes) e' criado na mesma escrita.
+//Retorna 0 se bem sucedido ou -1, caso contrario
+int inodeCreateArea (unsigned int numSectors, Disk *d);
+
 //Funcao que limpa todo o conteudo de um i-node. O i-node e' salvo em disco,
 //sobrescrevendo-o se ja existente. Retorna 0 se bem sucedido ou -1, caso
 //contrario
@@ -38,13 +68,60 @@ int inodeClear (Inode *i);
 
 //Funcao que persiste um i-node em seu disco. Retorna 0 se gravacao bem sucedida
 //ou -1 caso contrario. I-nodes sao salvos a partir do setor 2. Numero de
-//i-nodes por setor pode variar de acordo com o tamanho do tipo unsigned int
+//i-nodes por setor pode variar de acordo com o tamanho do tipo unsigned int.
+//O i-node e' marcado como sujo na cache de i-nodes e gravado em seu setor na
+//substituicao, em inodeSync ou pela thread de gravacao em segundo plano da
+//cache de setores, com os limites de idade e proporcao de bcacheSetFlusher
 int inodeSave (Inode *i);
 
 //Funcao que recupera um i-node a partir do disco. Retorna ponteiro para o
-//i-node lido ou NULL em caso de falha.
+//i-node lido ou NULL em caso de falha. O i-node retornado e' uma copia
+//privada, a ser liberada com free
 Inode* inodeLoad (unsigned int number, Disk *d);
 
+//Funcao que le de uma vez os inodeNumInodesPerSector() i-nodes do setor que
+//contem o i-node number do disco d, decodificando o setor inteiro em uma
+//unica passada. inodes deve possuir inodeNumInodesPerSector() posicoes, que
+//recebem copias privadas na ordem do setor, como em inodeLoad (liberar cada
+//uma com free). I-nodes presentes na cache de i-nodes sao copiados dela.
+//Retorna o numero do primeiro i-node do setor ou 0 em caso de falha
+unsigned int inodeLoadSector (unsigned int number, Disk *d, Inode **inodes);
+
+//Funcao que grava os i-nodes de um setor com uma unica escrita, codificando
+//o setor inteiro em uma unica passada. inodes possui
+//inodeNumInodesPerSector() posicoes, na ordem do setor (como em
+//inodeLoadSector); posicoes NULL mantem o i-node do setor ou o i-node sujo
+//presente na cache de i-nodes. As entradas da cache sao atualizadas e
+//deixam de estar sujas. Retorna 0 se bem sucedida ou -1 caso contrario
+//(inclusive se algum i-node nao estiver em sua posicao do setor)
+int inodeSaveSector (Inode **inodes);
+
+//Funcao que obtem da cache de i-nodes uma referencia ao i-node number do
+//disco d, lendo-o do disco se ausente. A referencia e' compartilhada por
+//todos que obtiverem o mesmo i-node, nao e' substituida enquanto estiver em
+//uso e deve ser devolvida com inodePut (nunca com free). Modificacoes sao
+//persistidas com inodeSave. Retorna NULL em caso de falha ou se todas as
+//entradas da cache estiverem em uso
+Inode* inodeGet (unsigned int number, Disk *d);
+
+//Funcao que devolve uma referencia obtida por inodeGet
+void inodePut (Inode *i);
+
+//Funcao que grava em seus setores os i-nodes sujos do disco d presentes na
+//cache de i-nodes (de todos os discos, se d for NULL). I-nodes sujos de um
+//mesmo setor sao gravados juntos, com uma leitura e uma escrita do setor.
+//Retorna 0 se bem sucedida ou -1 caso algum i-node nao possa ser gravado
+int inodeSync (Disk *d);
+
+//Funcao que grava os i-nodes sujos do disco d, como em inodeSync, e remove
+//da cache todos os seus i-nodes. Deve ser chamada antes de desconectar o
+//disco. Retorna 0 se bem sucedida ou -1 caso algum i-node nao possa ser
+//gravado ou permaneca em uso (referencias de inodeGet nao devolvidas)
+int inodeCacheInvalidate (Disk *d);
+
+//Funcao que copia para *stats os contadores da cache de i-nodes
+void inodeCacheGetStats (InodeCacheStats *stats);
+
 //Funcao que modifica o tipo de arquivo referente a um i-node
 void inodeSetFileType (Inode *i, unsigned int fileType);
 
@@ -65,7 +142,10 @@ void inodeSetRefCount (Inode *i, unsigned int refCount);
 
 //Funcao que adiciona um endereco ao fim do array de blocos de um i-node
 //Retorna -1 caso a inclusao do endereco nao seja bem sucedida
-//E' a unica funcao que salva automaticamente o i-node em disco
+//E' a unica funcao que salva automaticamente o i-node em disco. Apenas os
+//i-nodes alterados da cadeia sao salvos: o ultimo, registrado em memoria, e
+//o anterior a uma nova extensao. Em i-nodes com extents, blockAddr deve ser
+//diferente de 0
 int inodeAddBlock (Inode *i, unsigned int blockAddr);
 
 //Funcao que retorna o numero de um i-node.
@@ -16,8 +16,10 @@
 #include "myfs.h"
 #include "vfs.h"
 #include "inode.h"
+#include "bcache.h"
 
 #define MAX_CONNECTEDDISKS 1
+#define MAX_STRIPEMEMBERS 8
 
 #define RESULT_MSGDELAY 1000
 
@@ -101,6 +103,158 @@ void doDiskConnect(char *rawDiskPath) {
 	SLEEP (RESULT_MSGDELAY);
 }
 
+//Interface para conectar ao sistema operacional hipotetico um disco virtual
+//em faixas (RAID-0), formado por varios discos existentes
+void doDiskConnectStriped (void) {
+	if ( connectedDisks == MAX_CONNECTEDDISKS )
+		printf ("\n!! DiskStriped: FAILED. "
+		        "Maximum number of connected disks reached!\n");
+	else {
+		int id = -1;
+		unsigned int numMembers;
+		unsigned long stripeSectors;
+		char paths[MAX_STRIPEMEMBERS][MAX_FILENAME_LENGTH+1];
+		char *members[MAX_STRIPEMEMBERS];
+		for (int a=0; a<MAX_CONNECTEDDISKS; a++)
+			if (!disks[a]) { 
+				id = a;
+				break;
+			}
+		printf ("\n>> DiskStriped: Number of member disks (2-%d): ",
+		        MAX_STRIPEMEMBERS);
+		scanf (" %u", &numMembers);
+		if ( numMembers < 2 || numMembers > MAX_STRIPEMEMBERS ) {
+			printf ("\n!! DiskStriped: FAILED. Invalid number of "
+			        "member disks!\n");
+			SLEEP (RESULT_MSGDELAY);
+			return;
+		}
+		for (unsigned int a=0; a<numMembers; a++) {
+			printf (">> DiskStriped: Raw disk file of member %u "
+			        "(e.g. 1024cyl.dsk): ", a);
+			scanf (" %s", paths[a]);
+			members[a] = paths[a];
+		}
+		printf (">> DiskStriped: Stripe size in # of sectors "
+		        "(0: cancel): ");
+		scanf (" %lu", &stripeSectors);
+		if (!stripeSectors) return;
+		printf ("\n-- Connecting... "); fflush (stdout);
+		disks[id] = diskConnectStriped (id, members, numMembers,
+		                                stripeSectors);
+		if (disks[id]) {
+			printf ("Striped disk with %u members successfully "
+			        "connected\n", numMembers);
+			connectedDisks++;
+		}
+		else
+			printf ("\n!! DiskStriped: FAILED. No such file or "
+			        "file is inaccessible/corrupted\n");
+	}
+	SLEEP (RESULT_MSGDELAY);
+}
+
+//Interface para conectar ao sistema operacional hipotetico um disco formado
+//por uma imagem base e um arquivo de overlay, que recebe todas as escritas
+void doDiskConnectOverlay (void) {
+	if ( connectedDisks == MAX_CONNECTEDDISKS )
+		printf ("\n!! DiskOverlay: FAILED. "
+		        "Maximum number of connected disks reached!\n");
+	else {
+		int id = -1;
+		char basePath[MAX_FILENAME_LENGTH+1];
+		char overlayPath[MAX_FILENAME_LENGTH+1];
+		for (int a=0; a<MAX_CONNECTEDDISKS; a++)
+			if (!disks[a]) { 
+				id = a;
+				break;
+			}
+		printf ("\n>> DiskOverlay: Base raw disk file "
+		        "(e.g. 64cyl.dsk): ");
+		scanf (" %s", basePath);
+		printf (">> DiskOverlay: Overlay file, created if missing "
+		        "(e.g. 64cyl.ovl): ");
+		scanf (" %s", overlayPath);
+		printf ("\n-- Connecting... "); fflush (stdout);
+		disks[id] = diskConnectOverlay (id, basePath, overlayPath);
+		if (disks[id]) {
+			printf ("Disk %s with overlay %s successfully "
+			        "connected\n", basePath, overlayPath);
+			connectedDisks++;
+		}
+		else
+			printf ("\n!! DiskOverlay: FAILED. No such file or "
+			        "file is inaccessible/corrupted\n");
+	}
+	SLEEP (RESULT_MSGDELAY);
+}
+
+//Interface para conectar ao sistema operacional hipotetico um disco lento
+//precedido de uma camada rapida persistente (cache de setores em arquivo)
+void doDiskConnectTiered (void) {
+	if ( connectedDisks == MAX_CONNECTEDDISKS )
+		printf ("\n!! DiskTiered: FAILED. "
+		        "Maximum number of connected disks reached!\n");
+	else {
+		int id = -1;
+		char slowPath[MAX_FILENAME_LENGTH+1];
+		char cachePath[MAX_FILENAME_LENGTH+1];
+		unsigned long cacheSectors;
+		char policy;
+		for (int a=0; a<MAX_CONNECTEDDISKS; a++)
+			if (!disks[a]) { 
+				id = a;
+				break;
+			}
+		printf ("\n>> DiskTiered: Slow raw disk file "
+		        "(e.g. 64cyl.dsk): ");
+		scanf (" %s", slowPath);
+		printf (">> DiskTiered: Cache tier file (e.g. 64cyl.tier): ");
+		scanf (" %s", cachePath);
+		printf (">> DiskTiered: Cache tier sectors, if creating it: ");
+		scanf (" %lu", &cacheSectors);
+		printf (">> DiskTiered: Write policy, [B]ack or [T]hrough: ");
+		scanf (" %c", &policy);
+		printf ("\n-- Connecting... "); fflush (stdout);
+		disks[id] = diskConnectTiered (id, slowPath, cachePath,
+		                               cacheSectors,
+		                               (policy == 'T' || policy == 't'
+		                                ? DISK_TIER_WRITETHROUGH
+		                                : DISK_TIER_WRITEBACK));
+		if (disks[id]) {
+			printf ("Disk %s with cache tier %s successfully "
+			        "connected\n", slowPath, cachePath);
+			connectedDisks++;
+		}
+		else
+			printf ("\n!! DiskTiered: FAILED. No such file or "
+			        "file is inaccessible/corrupted\n");
+	}
+	SLEEP (RESULT_MSGDELAY);
+}
+
+//Interface para gravar no disco lento os setores sujos da camada rapida de
+//um disco conectado ao sistema operacional hipotetico
+void doDiskTierWriteBack (void) {
+	if ( !connectedDisks )
+		printf ("\n!! DiskTierWriteBack: No connected disks!\n");
+	else {
+		int id;
+		printf ("\n>> DiskTierWriteBack: Disk ID: ");
+		scanf (" %u", &id);
+		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
+			printf ("\n!! DiskTierWriteBack: FAILED. "
+			        "Invalid identifier!\n");
+		else if (diskTierWriteBack (disks[id]) < 0)
+			printf ("\n!! DiskTierWriteBack: FAILED. Disk has no "
+			        "cache tier or a sector could not be written\n");
+		else
+			printf ("\n-- DiskTierWriteBack: Cache tier of disk %d "
+			        "written back\n", id);
+	}
+	SLEEP (RESULT_MSGDELAY);
+}
+
 //Interface para listar dados dos discos atualmente conectados ao sistema
 //operacional hipotetico
 void doDiskList (void) {
@@ -145,8 +299,8 @@ void doDiskReadPrintSectors (void) {
 				unsigned char sector[DISK_SECTORDATASIZE]; 
 				if ( to > numSectors ) to = numSectors;
 				for (unsigned long a=from; a<=to; a++) {
-					if ( diskReadSector (disks[id],
-					                     a, sector) < 0 )
+					if ( bcacheReadSector (disks[id],
+					                       a, sector) < 0 )
 						printf ("\n!! DiskReadSector: "
 						        "FAILED. Cannot read!"
 						        "\n");
@@ -166,6 +320,115 @@ void doDiskReadPrintSectors (void) {
 	SLEEP (RESULT_MSGDELAY);
 }
 
+//Interface para conferir o CRC de todos os setores de um disco conectado ao
+//sistema operacional hipotetico
+void doDiskVerify (void) {
+	if ( !connectedDisks )
+		printf ("\n!! DiskVerify: No connected disks!\n");
+	else {
+		int id;
+		printf ("\n>> DiskVerify: Disk ID: ");
+		scanf (" %u", &id);
+		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
+			printf ("\n!! DiskVerify: FAILED. "
+			        "Invalid identifier!\n");
+		else {
+			unsigned long firstBad;
+			long bad = diskVerify (disks[id], &firstBad);
+			if (bad < 0)
+				printf ("\n!! DiskVerify: FAILED. "
+				        "Could not read disk %d!\n", id);
+			else if (bad == 0)
+				printf ("\n-- DiskVerify: Disk %d is intact\n", id);
+			else
+				printf ("\n!! DiskVerify: Disk %d has %ld corrupted "
+				        "sectors (first: %lu)\n", id, bad,
+				        firstBad);
+		}
+	}
+	SLEEP (RESULT_MSGDELAY);
+}
+
+//Interface para ativar ou desativar o buffer de trilha de um disco conectado
+//ao sistema operacional hipotetico
+void doDiskTrackBuffer (void) {
+	if ( !connectedDisks )
+		printf ("\n!! DiskTrackBuffer: No connected disks!\n");
+	else {
+		int id;
+		printf ("\n>> DiskTrackBuffer: Disk ID: ");
+		scanf (" %u", &id);
+		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
+			printf ("\n!! DiskTrackBuffer: FAILED. "
+			        "Invalid identifier!\n");
+		else {
+			char enable;
+			printf (">> DiskTrackBuffer: Enable track buffer (y/n): ");
+			scanf (" %c", &enable);
+			enable = (enable == 'Y' || enable == 'y');
+			if (diskSetTrackBuffer (disks[id], enable) < 0)
+				printf ("\n!! DiskTrackBuffer: FAILED. "
+				        "Not enough memory!\n");
+			else
+				printf ("\n-- DiskTrackBuffer: Track buffer %s on "
+				        "disk %d\n", (enable ? "enabled" : "disabled"),
+				        id);
+		}
+	}
+	SLEEP (RESULT_MSGDELAY);
+}
+
+//Interface para mostrar os contadores de desempenho de um disco conectado ao
+//sistema operacional hipotetico, com opcao de zera-los
+void doDiskStats (void) {
+	if ( !connectedDisks )
+		printf ("\n!! DiskStats: No connected disks!\n");
+	else {
+		int id;
+		printf ("\n>> DiskStats: Disk ID: ");
+		scanf (" %u", &id);
+		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
+			printf ("\n!! DiskStats: FAILED. "
+			        "Invalid identifier!\n");
+		else {
+			DiskStats st;
+			char reset;
+			unsigned long calls;
+			diskGetStats (disks[id], &st);
+			calls = st.readCalls + st.writeCalls;
+			printf ("\n-- DiskStats: Disk %d\n", id);
+			printf ("-- Reads: %lu calls; %lu sectors; %lu bytes\n",
+			        st.readCalls, st.sectorsRead, st.bytesRead);
+			printf ("-- Writes: %lu calls; %lu sectors; %lu bytes\n",
+			        st.writeCalls, st.sectorsWritten,
+			        st.bytesWritten);
+			printf ("-- Seeks: %lu; Cylinders traversed: %lu; "
+			        "Seek delay: %lu ms\n", st.seeks,
+			        st.cylindersTraversed, st.seekDelayUs / 1000);
+			printf ("-- Latency per call: avg %lu us; max %lu us\n",
+			        (calls ? st.totalLatencyUs / calls : 0),
+			        st.maxLatencyUs);
+			printf ("-- Checksum errors: %lu\n", st.checksumErrors);
+			printf ("-- Track buffer: %lu sectors hit; "
+			        "%lu tracks loaded\n", st.trackBufHits,
+			        st.trackBufMisses);
+			printf ("-- Cache tier: %lu sectors hit; %lu missed; "
+			        "%lu promoted; %lu written back\n", st.tierHits,
+			        st.tierMisses, st.tierPromotions,
+			        st.tierWriteBacks);
+			printf ("-- Modeled disk time: %lu ms\n",
+			        diskGetModeledTime (disks[id]) / 1000);
+			printf (">> DiskStats: Reset counters (y/n): ");
+			scanf (" %c", &reset);
+			if (reset == 'Y' || reset == 'y') {
+				diskResetStats (disks[id]);
+				printf ("-- DiskStats: Counters reset\n");
+			}
+		}
+	}
+	SLEEP (RESULT_MSGDELAY);
+}
+
 //Interface para desconectar um disco do sistema operacional hipotetico
 void doDiskDisconnect ( int id ) {
 	if ( !connectedDisks )
@@ -183,6 +446,10 @@ void doDiskDisconnect ( int id ) {
 			        "disconnect the root filesystem disk\n");
 		else {
 			printf ("\n-- Disconnecting... "); fflush (stdout);
+			int inodeRet = inodeCacheInvalidate (disks[id]);
+			if ( bcacheInvalidate (disks[id]) < 0 || inodeRet < 0 )
+				printf ("\n!! DiskDisconnect: WARNING. Cached "
+				        "sectors could not be written!\n");
 			if ( diskDisconnect (disks[id]) > -1 ) {
 				printf ("Disk %d successfully disconnected."
 					"\n", id);
@@ -293,6 +560,63 @@ void doFSShowFDs (void) {
 }
 
 
+//Interface para mostrar os contadores das caches de setores e de i-nodes do
+//sistema operacional hipotetico
+void doFSCacheStats (void) {
+	BCacheStats st;
+	InodeCacheStats ist;
+	unsigned long accesses;
+	bcacheGetStats (&st);
+	accesses = st.hits + st.misses;
+	printf ("\n-- CacheStats: %u sectors (%u dirty; %u pinned)\n",
+	        st.numEntries, st.dirtyEntries, st.pinnedEntries);
+	printf ("-- Hits: %lu; Misses: %lu; Hit ratio: %lu%%\n", st.hits,
+	        st.misses, (accesses ? st.hits * 100 / accesses : 0));
+	printf ("-- Evictions: %lu; Write-backs: %lu; Bypassed: %lu\n",
+	        st.evictions, st.writebacks, st.bypasses);
+	printf ("-- Background flush batches: %lu\n", st.flushBatches);
+	inodeCacheGetStats (&ist);
+	accesses = ist.hits + ist.misses;
+	printf ("-- Inode cache: %u inodes (%u dirty)\n", ist.numEntries,
+	        ist.dirtyEntries);
+	printf ("-- Hits: %lu; Misses: %lu; Hit ratio: %lu%%\n", ist.hits,
+	        ist.misses, (accesses ? ist.hits * 100 / accesses : 0));
+	printf ("-- Evictions: %lu; Write-backs: %lu (%lu sectors)\n",
+	        ist.evictions, ist.writebacks, ist.sectorWrites);
+	SLEEP (RESULT_MSGDELAY);
+}
+
+//Interface para ajustar a thread de gravacao em segundo plano da cache de
+//setores
+void doFSFlusher (void) {
+	unsigned long ageMs;
+	unsigned int ratio;
+	printf ("\n>> Flusher: Max dirty age in ms (0 disables the thread): ");
+	scanf (" %lu", &ageMs);
+	printf (">> Flusher: Dirty ratio that forces a flush (1-100%%): ");
+	scanf (" %u", &ratio);
+	if ( bcacheSetFlusher (ageMs, ratio) < 0 )
+		printf ("\n!! Flusher: FAILED. Invalid dirty ratio or the "
+		        "thread could not be created\n");
+	else
+		printf ("\n-- Flusher: Dirty age %lu ms; dirty ratio %u%%\n",
+		        ageMs, ratio);
+	SLEEP (RESULT_MSGDELAY);
+}
+
+//Interface para gravar em disco todos os setores sujos da cache de setores
+void doFSSync (void) {
+	int inodeRet;
+	printf ("\n-- Syncing... "); fflush (stdout);
+	inodeRet = inodeSync (NULL);
+	if ( bcacheSync () < 0 || inodeRet < 0 )
+		printf ("\n!! Sync: FAILED. Some sectors could not be "
+		        "written\n");
+	else
+		printf ("All dirty sectors written\n");
+	SLEEP (RESULT_MSGDELAY);
+}
+
 //Interface para desmontar o atual sistema de arquivos raiz
 void doFSUnmountRoot (void) {
 	if ( !rd )
@@ -651,6 +975,9 @@ void fsMenuSelection (void) {
 		          "     [F]ormat a disk (high-level format)\n"
 		          "     [M]ount root filesystem\n"
 		          "     [S]how file descriptors in use\n"
+		          "     [C]ache statistics\n"
+		          "     [W]riteback flusher tuning\n"
+		          "     s[Y]nc dirty sectors to disk\n"
 			  "     [U]mount root filesystem\n"
 		          "     [<]back to MAIN menu\n"
 		          "\n>> Your selection: ", connectedDisks,
@@ -663,6 +990,9 @@ void fsMenuSelection (void) {
 			case 'F': case 'f': doFSFormat(); break;
 			case 'M': case 'm': doFSMountRoot(); break;
 			case 'S': case 's': doFSShowFDs(); break;
+			case 'C': case 'c': doFSCacheStats(); break;
+			case 'W': case 'w': doFSFlusher(); break;
+			case 'Y': case 'y': doFSSync(); break;
 			case 'U': case 'u': doFSUnmountRoot(); break;
 		}
 	}
@@ -676,8 +1006,15 @@ void diskMenuSelection (void) {
 			  "               Disks: %u / Root Disk: %d\n"
 		          "     [B]uild/rebuild a disk (Low-level format)\n"
 		          "     [C]onnect a disk\n"
+		          "     [A]ggregate disks as a striped disk (RAID-0)\n"
+		          "     [O]verlay: connect a disk with copy-on-write file\n"
+		          "     [H]ybrid: connect a disk with a cache tier file\n"
 			  "     [L]ist connected disks\n"
 			  "     [R]ead/print sector range from a disk\n"
+			  "     [S]tatistics of a disk\n"
+			  "     [T]rack buffer of a disk (on/off)\n"
+			  "     [V]erify sector checksums of a disk\n"
+			  "     [W]rite back the cache tier of a disk\n"
 		          "     [D]isconnect a disk\n"
 		          "     [<]back to MAIN menu\n"
 		          "\n>> Your selection: ", connectedDisks,
@@ -687,8 +1024,15 @@ void diskMenuSelection (void) {
 		switch (choice) {
 			case 'B': case 'b': doDiskBuild(); break;
 			case 'C': case 'c': doDiskConnect(NULL); break;
+			case 'A': case 'a': doDiskConnectStriped(); break;
+			case 'O': case 'o': doDiskConnectOverlay(); break;
+			case 'H': case 'h': doDiskConnectTiered(); break;
 			case 'L': case 'l': doDiskList(); break;
 			case 'R': case 'r': doDiskReadPrintSectors(); break;
+			case 'S': case 's': doDiskStats(); break;
+			case 'T': case 't': doDiskTrackBuffer(); break;
+			case 'V': case 'v': doDiskVerify(); break;
+			case 'W': case 'w': doDiskTierWriteBack(); break;
 			case 'D': case 'd': doDiskDisconnect(NO_ID); break;
 		}
 	}
@@ -18,6 +18,7 @@
 #include "myfs.h"
 #include "vfs.h"
 #include "inode.h"
+#include "bcache.h"
 #include "util.h"
 
 //Declaracoes globais
@@ -77,20 +78,11 @@ int myFSFormat (Disk *d, unsigned int blockSize) {
 
     int freeBlocks = numBlocos - espacoInode;
     printf("Livres: %d blocos\n",freeBlocks);
-    int aux=0;
-    //Cria inodes
-    for (unsigned int i = offset; i <= espacoInode + offset; ++i) {
-		// Cria inode apos o inicial
-        for (int j = 0; j < inodeNumInodesPerSector(); j++)
-        {
-            Inode *inode = inodeCreate(aux,d);
-            // inodeAddBlock(inode,i);
-            inodeSave(inode);
-            aux++;
-        }
-       
-    }
-    blocoLivre = espacoInode + offset + 1;
+    //Cria inodes de toda a area em uma unica escrita
+    if (inodeCreateArea(espacoInode + 1, d) != 0)
+        return -1;
+    //Blocos de dados comecam apos a area de i-nodes e seu mapa de livres
+    blocoLivre = espacoInode + offset + 1 + inodeAreaNumMapSectors(espacoInode + 1);
 
 	// // Define o primeiro Inode após o offset como a raiz
 	// unsigned int numeroRaiz = inodeFindFreeInode(inodeAreaBeginSector(), d);
@@ -156,6 +148,49 @@ int myFSRead (int fd, char *buf, unsigned int nbytes) {
 	return -1;
 }
 
+//Funcao para a leitura sem copia de um arquivo, a partir de um descritor
+//de arquivo existente. O setor do bloco que contem o byte offset e' fixado
+//na cache de setores e um ponteiro para seus dados e' retornado; *len
+//recebe os bytes validos ate o fim do setor ou do arquivo. Retorna NULL em
+//caso de erro ou fim de arquivo
+const char* myFSReadRef (int fd, unsigned int offset, unsigned int *len) {
+	if (fd <= 0 || fd > MAX_FDS || arquivos[fd-1] == NULL || !len)
+		return NULL;
+
+	Arquivo *arquivo = arquivos[fd-1];
+	unsigned int fileSize = inodeGetFileSize(arquivo->inode);
+	unsigned int inSector = offset % DISK_SECTORDATASIZE;
+	unsigned int avail = DISK_SECTORDATASIZE - inSector;
+	if (offset >= fileSize) {
+		*len = 0;
+		return NULL;
+	}
+
+	//Setor do bloco que contem o byte offset
+	unsigned int blockAddr = inodeGetBlockAddr(arquivo->inode,
+	                                           offset / arquivo->blocksize);
+	if (blockAddr == 0)
+		return NULL;
+	const unsigned char *sector = bcachePin(arquivo->disk, blockAddr
+	                   + offset % arquivo->blocksize / DISK_SECTORDATASIZE);
+	if (sector == NULL)
+		return NULL;
+
+	if (avail > fileSize - offset)
+		avail = fileSize - offset;
+	if (*len > avail)
+		*len = avail;
+	return (const char *) &sector[inSector];
+}
+
+//Funcao para devolver uma referencia obtida por myFSReadRef. Retorna 0
+//caso bem sucedido, ou -1 caso contrario
+int myFSReadRelease (int fd, const char *ref) {
+	if (fd <= 0 || fd > MAX_FDS || arquivos[fd-1] == NULL)
+		return -1;
+	return bcacheUnpin((const unsigned char *) ref);
+}
+
 //Funcao para a escrita de um arquivo, a partir de um descritor de
 //arquivo existente. Os dados de buf serao copiados para o disco e
 //terao tamanho maximo de nbytes. Retorna o numero de bytes
@@ -204,9 +239,10 @@ int myFSWrite(int fd, const char *buf, unsigned int nbytes) {
         //define a quantidade de bytes offset utilizados 
         int offset = inodeAreaBeginSector();
         
-        //Le o setor para verificar se possui alguma variável diferente de zero 
+        //Le o bloco inteiro para verificar se possui alguma variável diferente de zero 
         unsigned char blockData[blocksize];
-        if (diskReadSector(d, blockAddr, blockData) != 0) {
+        unsigned int sectorsPerBlock = blocksize / DISK_SECTORDATASIZE;
+        if (bcacheReadSectors(d, blockAddr, sectorsPerBlock, blockData) != 0) {
             return -1;
         }
         
@@ -215,7 +251,7 @@ int myFSWrite(int fd, const char *buf, unsigned int nbytes) {
         }
         //realiza a escrita dos byttes enquanto o byte não for 
         //difente de 0 ou seja encerra caso já tenha algo escrito 
-        if (diskWriteSector(d, blocoLivre, blockData) != 0) {
+        if (bcacheWriteSectors(d, blocoLivre, sectorsPerBlock, blockData) != 0) {
             return -1;
         }
         else{
@@ -236,12 +272,19 @@ int myFSWrite(int fd, const char *buf, unsigned int nbytes) {
 }
 
 //Funcao para fechar um arquivo, a partir de um descritor de arquivo
-//existente. Retorna 0 caso bem sucedido, ou -1 caso contrario
+//existente. Retorna 0 caso bem sucedido, ou -1 caso contrario. Se os
+//i-nodes sujos do disco nao puderem ser gravados, o descritor permanece
+//aberto
 int myFSClose (int fd) {
 	if (fd > 0 || fd <= MAX_FDS){
 
 		Arquivo *a = arquivos[fd-1];
 
+		//Todos os i-nodes sujos do disco do arquivo (inclusive os de
+		//outros arquivos) sao gravados, agrupados por setor
+		if (inodeSync(a->disk) != 0)
+			return -1;
+
 		arquivos[fd - 1] = NULL;
 		free(a->inode);
 		free(a);
@@ -311,6 +354,8 @@ int installMyFS (void) {
 	fs->linkFn = myFSLink;
 	fs->unlinkFn = myFSUnlink;
 	fs->closedirFn = myFSCloseDir;
+	fs->readrefFn = myFSReadRef;
+	fs->readreleaseFn = myFSReadRelease;
 	vfsInit();
 	vfsRegisterFS(fs);
 	return -1;
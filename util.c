@@ -11,6 +11,8 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "util.h"
 
 //Funcao para a conversao de unsigned int para um array de bytes (char[])
@@ -30,5 +32,81 @@ void ul2char (unsigned int ui, unsigned char *c) {
 void char2ul (unsigned char *c, unsigned int *ui) {
 	*ui = 0;
 	for (int i = 0; i < sizeof (unsigned int); i++)
-		*ui = *ui + (c[i] << (i*8));
+		*ui = *ui + ((unsigned int) c[i] << (i*8));
+}
+
+//Funcao para a conversao de count unsigned ints de ui para o array de bytes
+//c. Em plataformas little-endian com unsigned int de 4 bytes, a conversao
+//e' uma copia; em big-endian, uma inversao de bytes por elemento, que o
+//compilador vetoriza. Nas demais, ou se a ordem dos bytes nao for
+//conhecida, cada elemento passa por ul2char
+void ul2charArray (const unsigned int *ui, unsigned char *c,
+                   unsigned int count) {
+#if defined (__BYTE_ORDER__) && defined (__ORDER_LITTLE_ENDIAN__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (sizeof (unsigned int) == 4) {
+		memcpy (c, ui, count * sizeof (unsigned int));
+		return;
+	}
+#elif defined (__BYTE_ORDER__) && defined (__ORDER_BIG_ENDIAN__) && \
+      __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	if (sizeof (unsigned int) == 4) {
+		for (unsigned int i = 0; i < count; i++) {
+			unsigned int v = __builtin_bswap32 (ui[i]);
+			memcpy (&c[i * 4], &v, 4);
+		}
+		return;
+	}
+#endif
+	for (unsigned int i = 0; i < count; i++)
+		ul2char (ui[i], &c[i * sizeof (unsigned int)]);
+}
+
+//Funcao para a conversao do array de bytes c em count unsigned ints em ui,
+//como em ul2charArray
+void char2ulArray (const unsigned char *c, unsigned int *ui,
+                   unsigned int count) {
+#if defined (__BYTE_ORDER__) && defined (__ORDER_LITTLE_ENDIAN__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (sizeof (unsigned int) == 4) {
+		memcpy (ui, c, count * sizeof (unsigned int));
+		return;
+	}
+#elif defined (__BYTE_ORDER__) && defined (__ORDER_BIG_ENDIAN__) && \
+      __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	if (sizeof (unsigned int) == 4) {
+		for (unsigned int i = 0; i < count; i++) {
+			unsigned int v;
+			memcpy (&v, &c[i * 4], 4);
+			ui[i] = __builtin_bswap32 (v);
+		}
+		return;
+	}
+#endif
+	for (unsigned int i = 0; i < count; i++)
+		char2ul ((unsigned char *) &c[i * sizeof (unsigned int)],
+		         &ui[i]);
+}
+
+//Funcao que retorna o instante atual, em microssegundos
+unsigned long nowUs (void) {
+	struct timespec ts;
+	timespec_get (&ts, TIME_UTC);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+//Funcao que combina o endereco owner e a chave key para uma tabela hash
+unsigned long hashKey (const void *owner, unsigned long key) {
+	return (unsigned long) owner / sizeof (void*) * 31 + key;
+}
+
+//Funcao que escolhe, pelo algoritmo CLOCK, uma entrada de uma cache
+int clockSelect (unsigned int *hand, unsigned int numEntries,
+                 int (*canReplace) (unsigned int e)) {
+	for (unsigned int steps = 0; steps < 2 * numEntries; steps++) {
+		unsigned int e = *hand;
+		*hand = (*hand + 1) % numEntries;
+		if (canReplace (e)) return e;
+	}
+	return -1;
 }
@@ -26,4 +26,30 @@ void ul2char (unsigned int ui, unsigned char *c);
 //elementos de c serao considerados
 void char2ul (unsigned char *c, unsigned int *ui);
 
+//Funcao para a conversao de count unsigned ints de ui para o array de bytes
+//c, com o mesmo formato de ul2char (little-endian), em uma unica passada. O
+//array c deve possuir count * sizeof (unsigned int) elementos
+void ul2charArray (const unsigned int *ui, unsigned char *c,
+                   unsigned int count);
+
+//Funcao para a conversao do array de bytes c em count unsigned ints em ui,
+//com o mesmo formato de char2ul, em uma unica passada
+void char2ulArray (const unsigned char *c, unsigned int *ui,
+                   unsigned int count);
+
+//Funcao que retorna o instante atual, em microssegundos
+unsigned long nowUs (void);
+
+//Funcao que combina o endereco owner (como um Disk*) e a chave key em um
+//valor para a escolha do balde de uma tabela hash
+unsigned long hashKey (const void *owner, unsigned long key);
+
+//Funcao que escolhe, pelo algoritmo CLOCK, uma das numEntries entradas de
+//uma cache. O ponteiro *hand percorre as entradas, ate duas voltas, e
+//canReplace decide cada uma: retorna diferente de 0 para escolhe-la ou 0
+//para poupa-la (limpando seu bit de referencia, se for o caso). Retorna a
+//entrada escolhida ou -1 se nenhuma puder ser substituida
+int clockSelect (unsigned int *hand, unsigned int numEntries,
+                 int (*canReplace) (unsigned int e));
+
 #endif
@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include "vfs.h"
 #include "inode.h"
+#include "bcache.h"
 
 #define MAX_INSTALLED_FS 4
 
@@ -52,11 +53,16 @@ int vfsMountRoot (Disk *d, char fsId) {
 }
 
 //Funcao para a desmontagem do sistema de arquivos. Nao podem haver arquivos
-//ou diretorios abertos para a desmontagem. Retorna 0 caso bem sucedido e -1
-//caso contrario
+//ou diretorios abertos para a desmontagem. Os i-nodes e setores sujos do
+//disco nas caches sao gravados. Retorna 0 caso bem sucedido e -1 caso
+//contrario
 int vfsUnmountRoot ( void ) {
 	if ( !rootDisk || !rootFS ) return -1;
 	if ( !rootFS->isidleFn (rootDisk) ) return -1;
+	//I-nodes e setores modificados em cache sao gravados antes da
+	//desmontagem
+	if ( inodeSync (rootDisk) < 0 ) return -1;
+	if ( bcacheFlush (rootDisk) < 0 ) return -1;
 	rootFS = NULL;
 	rootDisk = NULL;
 	return 0;
@@ -101,6 +107,22 @@ int vfsWrite (int fd, const char *buf, unsigned int nbytes) {
         return rootFS->writeFn (fd, buf, nbytes);
 }
 
+//Funcao para a leitura sem copia de um arquivo, a partir de um descritor de
+//arquivo existente. Retorna um ponteiro somente leitura para os dados do
+//arquivo a partir do byte offset e escreve em *len o numero de bytes validos
+//a partir dele. Retorna NULL em caso de erro ou fim de arquivo
+const char* vfsReadRef (int fd, unsigned int offset, unsigned int *len) {
+	if ( !rootDisk || !rootFS || !rootFS->readrefFn ) return NULL;
+	return rootFS->readrefFn (fd, offset, len);
+}
+
+//Funcao para devolver uma referencia obtida por vfsReadRef. Retorna 0 caso
+//bem sucedido, ou -1 caso contrario
+int vfsReadRelease (int fd, const char *ref) {
+	if ( !rootDisk || !rootFS || !rootFS->readreleaseFn ) return -1;
+	return rootFS->readreleaseFn (fd, ref);
+}
+
 //Funcao para fechar um arquivo, a partir de um descritor de arquivo existente.
 //Retorna 0 caso bem sucedido, ou -1 caso contrario
 int vfsClose (int fd) {
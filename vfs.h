@@ -92,6 +92,21 @@ typedef struct fs_info {
 	//arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.	
 	int (*closedirFn) (int fd);
 
+	//Funcao para a leitura sem copia de um arquivo, a partir de um
+	//descritor de arquivo existente. Retorna um ponteiro somente leitura
+	//para os dados do arquivo a partir do byte offset, mantidos em um
+	//bloco fixado em memoria, e escreve em *len o numero de bytes validos
+	//a partir dele (no maximo o valor de entrada de *len). Retorna NULL
+	//em caso de erro ou fim de arquivo (*len igual a 0). Opcional: NULL
+	//se nao suportada.
+	const char* (*readrefFn) (int fd, unsigned int offset,
+	                          unsigned int *len);
+
+	//Funcao para devolver uma referencia obtida por readrefFn, desfazendo
+	//a fixacao de seu bloco. Retorna 0 caso bem sucedido, ou -1 caso
+	//contrario.
+	int (*readreleaseFn) (int fd, const char *ref);
+
 } FSInfo;
 
 //Funcao para inicializacao do sistema de arquivos virtual
@@ -129,6 +144,20 @@ int vfsRead (int fd, char *buf, unsigned int nbytes);
 //de sucesso ou -1, caso contrario
 int vfsWrite (int fd, const char *buf, unsigned int nbytes);
 
+//Funcao para a leitura sem copia de um arquivo, a partir de um descritor de
+//arquivo existente. Retorna um ponteiro somente leitura para os dados do
+//arquivo a partir do byte offset, mantidos fixados na cache de setores, e
+//escreve em *len o numero de bytes validos a partir dele: no maximo o valor
+//de entrada de *len, limitado ao fim do setor e do arquivo. A referencia deve
+//ser devolvida com vfsReadRelease. Retorna NULL em caso de erro, se o
+//sistema de arquivos nao suportar a operacao ou no fim do arquivo (*len
+//igual a 0). O cursor do arquivo nao e' alterado
+const char* vfsReadRef (int fd, unsigned int offset, unsigned int *len);
+
+//Funcao para devolver uma referencia obtida por vfsReadRef, que deixa de ser
+//valida. Retorna 0 caso bem sucedido, ou -1 caso contrario
+int vfsReadRelease (int fd, const char *ref);
+
 //Funcao para fechar um arquivo, a partir de um descritor de arquivo existente.
 //Retorna 0 caso bem sucedido, ou -1 caso contrario
 int vfsClose (int fd);